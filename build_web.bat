@@ -1 +1 @@
-em++ -Wall -Wno-missing-braces -O2 ./src/main.cpp -s WASM=1 -o ./build_web/index.js --preload-file ./obj/@/obj -fno-rtti -fno-exceptions -s EXTRA_EXPORTED_RUNTIME_METHODS=['UTF8ToString'] -s INITIAL_MEMORY=50mb -s USE_SDL=2 
\ No newline at end of file
+em++ -Wall -Wno-missing-braces -O2 -msimd128 -msse2 ./src/main.cpp -s WASM=1 -o ./build_web/index.js --preload-file ./obj/@/obj -fno-rtti -fno-exceptions -s EXTRA_EXPORTED_RUNTIME_METHODS=['UTF8ToString'] -s INITIAL_MEMORY=50mb -s USE_SDL=2 
\ No newline at end of file
@@ -0,0 +1,490 @@
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <atomic>
+
+#include "block_compression.h"
+#include "texture.h"
+
+//ids start at 1, so empty cache entries never match. Textures may be compressed on loader threads
+static std::atomic<unsigned int> next_compressed_texture_id{ 1 };
+
+static int compressed_block_bytes(const texture_compression compression)
+{
+    switch (compression)
+    {
+    case texture_compression::bc1: return 8;
+    case texture_compression::bc3: return 16;
+    case texture_compression::bc5: return 16;
+    case texture_compression::bc_material: return 32;
+    case texture_compression::bc_material_alpha: return 40;
+    case texture_compression::none: break;
+    }
+
+    return 0;
+}
+
+int compressed_level_size(const image& level, const texture_compression compression)
+{
+    const auto blocks_x = (level.width + compressed_block_size - 1) / compressed_block_size;
+    const auto blocks_y = (level.height + compressed_block_size - 1) / compressed_block_size;
+
+    return blocks_x * blocks_y * compressed_block_bytes(compression);
+}
+
+inline unsigned short pack_565(const int r, const int g, const int b)
+{
+    return static_cast<unsigned short>(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+}
+
+inline void unpack_565(const unsigned short packed, int& r, int& g, int& b)
+{
+    //replicate the high bits into the low bits, so 0 and 255 survive the round trip
+    r = (packed >> 11) & 31;
+    g = (packed >> 5) & 63;
+    b = packed & 31;
+
+    r = (r << 3) | (r >> 2);
+    g = (g << 2) | (g >> 4);
+    b = (b << 3) | (b >> 2);
+}
+
+/*
+ * Color block encoding. The endpoints are the corners of the block's color bounding
+ * box, inset slightly as the extremes are rarely the best fit. Channels that fall as
+ * green rises swap their extents, so the box diagonal follows the colors. Each texel
+ * then picks the closest of the four palette colors.
+ */
+static void encode_color_block(const rgba texels[16], unsigned char* out)
+{
+    int min_c[3] = { 255, 255, 255 };
+    int max_c[3] = { 0, 0, 0 };
+    int mean[3] = { 0, 0, 0 };
+
+    for (auto i = 0; i < 16; i++)
+    {
+        for (auto c = 0; c < 3; c++)
+        {
+            min_c[c] = std::min(min_c[c], static_cast<int>(texels[i].e[c]));
+            max_c[c] = std::max(max_c[c], static_cast<int>(texels[i].e[c]));
+            mean[c] += texels[i].e[c];
+        }
+    }
+
+    for (auto c = 0; c < 3; c++) mean[c] /= 16;
+
+    //covariance of red and blue with green
+    auto cov_rg = 0, cov_bg = 0;
+    for (auto i = 0; i < 16; i++)
+    {
+        const auto g = texels[i].g - mean[1];
+        cov_rg += (texels[i].r - mean[0]) * g;
+        cov_bg += (texels[i].b - mean[2]) * g;
+    }
+
+    for (auto c = 0; c < 3; c++)
+    {
+        const auto inset = (max_c[c] - min_c[c]) >> 4;
+        min_c[c] += inset;
+        max_c[c] -= inset;
+    }
+
+    if (cov_rg < 0) std::swap(min_c[0], max_c[0]);
+    if (cov_bg < 0) std::swap(min_c[2], max_c[2]);
+
+    auto color0 = pack_565(max_c[0], max_c[1], max_c[2]);
+    auto color1 = pack_565(min_c[0], min_c[1], min_c[2]);
+
+    //four color mode needs color0 > color1
+    if (color0 < color1) std::swap(color0, color1);
+
+    unsigned int indices = 0;
+
+    if (color0 != color1)
+    {
+        int palette[4][3];
+        unpack_565(color0, palette[0][0], palette[0][1], palette[0][2]);
+        unpack_565(color1, palette[1][0], palette[1][1], palette[1][2]);
+
+        for (auto c = 0; c < 3; c++)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+
+        for (auto i = 0; i < 16; i++)
+        {
+            auto best = 0;
+            auto best_dist = 0x7fffffff;
+
+            for (auto p = 0; p < 4; p++)
+            {
+                const auto dr = texels[i].r - palette[p][0];
+                const auto dg = texels[i].g - palette[p][1];
+                const auto db = texels[i].b - palette[p][2];
+                const auto dist = dr * dr + dg * dg + db * db;
+
+                if (dist < best_dist)
+                {
+                    best_dist = dist;
+                    best = p;
+                }
+            }
+
+            indices |= static_cast<unsigned int>(best) << (i * 2);
+        }
+    }
+
+    memcpy(out, &color0, 2);
+    memcpy(out + 2, &color1, 2);
+    memcpy(out + 4, &indices, 4);
+}
+
+static void decode_color_block(const unsigned char* block, unsigned char* out, const int texel_size)
+{
+    unsigned short color0, color1;
+    unsigned int indices;
+    memcpy(&color0, block, 2);
+    memcpy(&color1, block + 2, 2);
+    memcpy(&indices, block + 4, 4);
+
+    int palette[4][4];
+    unpack_565(color0, palette[0][0], palette[0][1], palette[0][2]);
+    unpack_565(color1, palette[1][0], palette[1][1], palette[1][2]);
+    palette[0][3] = palette[1][3] = palette[2][3] = 255;
+
+    if (color0 > color1)
+    {
+        for (auto c = 0; c < 3; c++)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        palette[3][3] = 255;
+    }
+    else
+    {
+        //three color mode, with transparent black
+        for (auto c = 0; c < 3; c++)
+        {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+        }
+        palette[3][3] = 0;
+    }
+
+    for (auto i = 0; i < 16; i++)
+    {
+        const auto* col = palette[(indices >> (i * 2)) & 3];
+        auto* texel = out + i * texel_size;
+
+        texel[0] = static_cast<unsigned char>(col[0]);
+        texel[1] = static_cast<unsigned char>(col[1]);
+        texel[2] = static_cast<unsigned char>(col[2]);
+        texel[3] = static_cast<unsigned char>(col[3]);
+    }
+}
+
+/*
+ * Single channel block encoding. The endpoints are the channel's min and max, with
+ * six evenly spaced values between them, and each texel picks the closest value.
+ */
+static void encode_channel_block(const unsigned char values[16], unsigned char* out)
+{
+    auto min_v = 255, max_v = 0;
+    for (auto i = 0; i < 16; i++)
+    {
+        min_v = std::min(min_v, static_cast<int>(values[i]));
+        max_v = std::max(max_v, static_cast<int>(values[i]));
+    }
+
+    out[0] = static_cast<unsigned char>(max_v);
+    out[1] = static_cast<unsigned char>(min_v);
+
+    unsigned long long indices = 0;
+
+    if (max_v > min_v)
+    {
+        //palette order is max, min, then the six steps from max to min
+        static const int step_to_index[8] = { 1, 7, 6, 5, 4, 3, 2, 0 };
+
+        const auto range = max_v - min_v;
+
+        for (auto i = 0; i < 16; i++)
+        {
+            const auto step = ((values[i] - min_v) * 7 + range / 2) / range;
+            indices |= static_cast<unsigned long long>(step_to_index[step]) << (i * 3);
+        }
+    }
+
+    for (auto b = 0; b < 6; b++)
+    {
+        out[2 + b] = static_cast<unsigned char>(indices >> (b * 8));
+    }
+}
+
+static void decode_channel_block(const unsigned char* block, unsigned char* out, const int texel_size)
+{
+    const int a0 = block[0];
+    const int a1 = block[1];
+
+    int palette[8];
+    palette[0] = a0;
+    palette[1] = a1;
+
+    if (a0 > a1)
+    {
+        for (auto i = 1; i < 7; i++)
+        {
+            palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+        }
+    }
+    else
+    {
+        for (auto i = 1; i < 5; i++)
+        {
+            palette[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+        }
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+
+    unsigned long long indices = 0;
+    for (auto b = 0; b < 6; b++)
+    {
+        indices |= static_cast<unsigned long long>(block[2 + b]) << (b * 8);
+    }
+
+    for (auto i = 0; i < 16; i++)
+    {
+        out[i * texel_size] = static_cast<unsigned char>(palette[(indices >> (i * 3)) & 7]);
+    }
+}
+
+/*
+ * Gathers the 4x4 texels of a block from an uncompressed linear level. Texels past the
+ * edge of levels smaller than a block repeat the last row/column.
+ */
+static void gather_block(const image& level, const int block_x, const int block_y, unsigned char* out)
+{
+    const auto texel_size = level.n_channels;
+
+    for (auto y = 0; y < 4; y++)
+    {
+        const auto src_y = std::min(block_y * 4 + y, level.height - 1);
+
+        for (auto x = 0; x < 4; x++)
+        {
+            const auto src_x = std::min(block_x * 4 + x, level.width - 1);
+
+            memcpy(out + (y * 4 + x) * texel_size, level.data + (src_y * level.width + src_x) * texel_size, texel_size);
+        }
+    }
+}
+
+static void encode_block(const texture_compression compression, const unsigned char* texels, const int texel_size, unsigned char* out)
+{
+    rgba colors[16];
+    unsigned char channel[16];
+
+    const auto gather_channel = [&](const int offset) {
+        for (auto i = 0; i < 16; i++) channel[i] = texels[i * texel_size + offset];
+    };
+
+    switch (compression)
+    {
+    case texture_compression::bc1:
+        memcpy(colors, texels, sizeof(colors));
+        encode_color_block(colors, out);
+        break;
+
+    case texture_compression::bc3:
+        memcpy(colors, texels, sizeof(colors));
+        gather_channel(3);
+        encode_channel_block(channel, out);
+        encode_color_block(colors, out + 8);
+        break;
+
+    case texture_compression::bc5:
+        gather_channel(0);
+        encode_channel_block(channel, out);
+        gather_channel(1);
+        encode_channel_block(channel, out + 8);
+        break;
+
+    case texture_compression::bc_material:
+        for (auto i = 0; i < 16; i++) memcpy(&colors[i], texels + i * texel_size, sizeof(rgba));
+        encode_color_block(colors, out);
+        gather_channel(4);
+        encode_channel_block(channel, out + 8);
+        gather_channel(5);
+        encode_channel_block(channel, out + 16);
+        gather_channel(6);
+        encode_channel_block(channel, out + 24);
+        break;
+
+    case texture_compression::bc_material_alpha:
+        gather_channel(3);
+        encode_channel_block(channel, out);
+        encode_block(texture_compression::bc_material, texels, texel_size, out + 8);
+        break;
+
+    case texture_compression::none:
+        break;
+    }
+}
+
+static void decode_block(const texture_compression compression, const unsigned char* block, unsigned char* out, const int texel_size)
+{
+    switch (compression)
+    {
+    case texture_compression::bc1:
+        decode_color_block(block, out, texel_size);
+        break;
+
+    case texture_compression::bc3:
+        decode_color_block(block + 8, out, texel_size);
+        decode_channel_block(block, out + 3, texel_size);
+        break;
+
+    case texture_compression::bc5:
+        decode_channel_block(block, out, texel_size);
+        decode_channel_block(block + 8, out + 1, texel_size);
+        break;
+
+    case texture_compression::bc_material:
+        decode_color_block(block, out, texel_size);
+        decode_channel_block(block + 8, out + 4, texel_size);
+        decode_channel_block(block + 16, out + 5, texel_size);
+        decode_channel_block(block + 24, out + 6, texel_size);
+        for (auto i = 0; i < 16; i++) out[i * texel_size + 7] = 0;
+        break;
+
+    case texture_compression::bc_material_alpha:
+        decode_block(texture_compression::bc_material, block + 8, out, texel_size);
+        decode_channel_block(block, out + 3, texel_size);
+        break;
+
+    case texture_compression::none:
+        break;
+    }
+}
+
+static bool has_transparent_texels(const texture& tex, const int alpha_offset)
+{
+    for (auto i = 0; i < tex.level_count; i++)
+    {
+        const auto& level = tex.levels[i];
+        const auto texel_count = level.width * level.height;
+
+        for (auto t = 0; t < texel_count; t++)
+        {
+            if (level.data[t * level.n_channels + alpha_offset] != 255) return true;
+        }
+    }
+
+    return false;
+}
+
+void compress_texture(texture& tex)
+{
+    if (tex.compression != texture_compression::none || tex.level_count == 0) return;
+
+    //blocks are gathered from row order texels
+    convert_texture_layout(tex, texture_layout::linear);
+
+    auto compression = texture_compression::none;
+
+    switch (tex.format)
+    {
+    case texture_format::rgba8:
+        compression = has_transparent_texels(tex, 3) ? texture_compression::bc3 : texture_compression::bc1;
+        break;
+
+    case texture_format::normal_xy8:
+        compression = texture_compression::bc5;
+        break;
+
+    case texture_format::material8:
+        compression = has_transparent_texels(tex, 3) ? texture_compression::bc_material_alpha : texture_compression::bc_material;
+        break;
+    }
+
+    const auto block_bytes = compressed_block_bytes(compression);
+
+    for (auto i = 0; i < tex.level_count; i++)
+    {
+        auto& level = tex.levels[i];
+
+        const auto blocks_x = (level.width + compressed_block_size - 1) / compressed_block_size;
+        const auto blocks_y = (level.height + compressed_block_size - 1) / compressed_block_size;
+
+        auto* blocks = new unsigned char[compressed_level_size(level, compression)];
+        assert(blocks != nullptr);
+
+        unsigned char texels[16 * 8];
+
+        for (auto by = 0; by < blocks_y; by++)
+        {
+            for (auto bx = 0; bx < blocks_x; bx++)
+            {
+                gather_block(level, bx, by, texels);
+                encode_block(compression, texels, level.n_channels, blocks + (by * blocks_x + bx) * block_bytes);
+            }
+        }
+
+        delete[] level.data;
+        level.data = blocks;
+    }
+
+    //blocks are 4x4 tiles in row order
+    tex.layout = texture_layout::tiled;
+    tex.compression = compression;
+    tex.compressed_id = next_compressed_texture_id++;
+}
+
+/*
+ * Direct mapped cache of decoded blocks. Slots are picked from the low bits of the
+ * block coordinates, so the (up to) 2x2 blocks touched by a bilinear sample never
+ * evict each other.
+ */
+static const int decoded_block_cache_bits = 3;
+static const int decoded_block_cache_size = 1 << (decoded_block_cache_bits * 2);
+
+struct decoded_block
+{
+    unsigned int texture_id{};
+    int level{};
+    int block_idx{};
+    unsigned char texels[16 * 8]{};
+};
+
+
+static thread_local decoded_block decoded_block_cache[decoded_block_cache_size];
+
+inline const unsigned char* decoded_block_texel(const texture& tex, const int level, const int x, const int y)
+{
+    const auto& img = tex.levels[level];
+    const auto texel_size = img.n_channels;
+
+    const auto block_x = x >> 2;
+    const auto block_y = y >> 2;
+    const auto blocks_x = (img.width + compressed_block_size - 1) >> 2;
+
+    const auto block_idx = block_y * blocks_x + block_x;
+
+    const auto mask = (1 << decoded_block_cache_bits) - 1;
+    auto& entry = decoded_block_cache[(block_x & mask) | ((block_y & mask) << decoded_block_cache_bits)];
+
+    if (entry.texture_id != tex.compressed_id || entry.level != level || entry.block_idx != block_idx)
+    {
+        const auto block_bytes = compressed_block_bytes(tex.compression);
+        decode_block(tex.compression, img.data + block_idx * block_bytes, entry.texels, texel_size);
+
+        entry.texture_id = tex.compressed_id;
+        entry.level = level;
+        entry.block_idx = block_idx;
+    }
+
+    return entry.texels + ((y & 3) * 4 + (x & 3)) * texel_size;
+}
@@ -0,0 +1,45 @@
+#ifndef BLOCK_COMPRESSION_H
+#define BLOCK_COMPRESSION_H
+
+#include "image.h"
+
+struct texture;
+
+/*
+ * Block compressed texture storage, modelled on the BC formats used by GPUs. Each
+ * level is split into 4x4 texel blocks, stored in row order, and each block is
+ * encoded as endpoints plus per texel palette indices.
+ *
+ *  bc1          - rgba8, opaque. 8 bytes per block, 8x smaller.
+ *  bc3          - rgba8 with alpha. bc1 colors plus a bc4 alpha block, 4x smaller.
+ *  bc5          - normal_xy8. A bc4 block for each of x and y, 2x smaller.
+ *  bc_material  - material8 with opaque diffuse. bc1 diffuse, then bc4 blocks for
+ *                 normal x, normal y and specular exponent. 32 bytes per block, 4x smaller.
+ *  bc_material_alpha - bc_material plus a bc4 alpha block, 3.2x smaller.
+ *
+ * Samplers read compressed textures through the same texel fetches as uncompressed
+ * ones. Fetches decode whole blocks into a small per thread cache, so neighbouring
+ * fetches (such as the 2x2 texels of a bilinear sample) only decode a block once.
+ */
+enum class texture_compression
+{
+    none,
+    bc1,
+    bc3,
+    bc5,
+    bc_material,
+    bc_material_alpha,
+};
+
+static const int compressed_block_size = 4;
+
+//picks a block format from the texture's format and contents, then encodes every level
+void compress_texture(texture& tex);
+
+//bytes of one compressed level
+int compressed_level_size(const image& level, texture_compression compression);
+
+//decoded texel of a compressed texture, in the texture's uncompressed format. y is a raw (top down) row.
+inline const unsigned char* decoded_block_texel(const texture& tex, int level, int x, int y);
+
+#endif
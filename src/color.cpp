@@ -0,0 +1,204 @@
+#include <cmath>
+#include <cstring>
+
+#include "color.h"
+#include "simd.h"
+
+inline unsigned short color_scale_to_fixed(const float scale)
+{
+    //scales beyond 255 saturate every non zero channel anyway
+    if (!(scale > 0)) return 0;
+    if (scale >= 255.0f) return 65535;
+
+    const auto fixed = static_cast<int>(scale * 256.0f + 0.5f);
+
+    return static_cast<unsigned short>(fixed > 65535 ? 65535 : fixed);
+}
+
+#if USE_SSE2
+inline __m128i load_rgba(const rgba& col)
+{
+    int packed;
+    memcpy(&packed, &col, sizeof(packed));
+
+    return _mm_cvtsi32_si128(packed);
+}
+
+inline rgba store_rgba(const __m128i packed)
+{
+    const auto val = _mm_cvtsi128_si32(packed);
+
+    rgba col;
+    memcpy(&col, &val, sizeof(col));
+
+    return col;
+}
+
+/*
+ * Multiplies 16 bit channels (0-255) by 8.8 fixed point scales. Shifting the channel
+ * up by 8 bits first means the high half of the 32 bit product is exactly (c * s) >> 8.
+ * The result is clamped to 255 using min(x, 255) = x - saturate(x - 255).
+ */
+inline __m128i scale_channels_u16(const __m128i channels, const __m128i scales)
+{
+    const auto max_channel = _mm_set1_epi16(255);
+
+    const auto product = _mm_mulhi_epu16(_mm_slli_epi16(channels, 8), scales);
+
+    return _mm_sub_epi16(product, _mm_subs_epu16(product, max_channel));
+}
+#endif
+
+inline rgba color_scale(const rgba& col, const float scale)
+{
+    const auto fixed = color_scale_to_fixed(scale);
+
+#if USE_SSE2
+    const auto zero = _mm_setzero_si128();
+    const auto channels = _mm_unpacklo_epi8(load_rgba(col), zero);
+    const auto scaled = scale_channels_u16(channels, _mm_set1_epi16(static_cast<short>(fixed)));
+
+    return store_rgba(_mm_packus_epi16(scaled, zero));
+#else
+    rgba ret;
+    for (auto i = 0; i < 4; i++)
+    {
+        const auto res = (static_cast<unsigned int>(col.e[i]) * fixed) >> 8;
+        ret.e[i] = static_cast<unsigned char>(res > 255 ? 255 : res);
+    }
+    return ret;
+#endif
+}
+
+inline rgba color_modulate(const rgba& col, const v3& rgb_scale)
+{
+    const auto r_fixed = color_scale_to_fixed(rgb_scale.x);
+    const auto g_fixed = color_scale_to_fixed(rgb_scale.y);
+    const auto b_fixed = color_scale_to_fixed(rgb_scale.z);
+
+#if USE_SSE2
+    const auto zero = _mm_setzero_si128();
+    const auto channels = _mm_unpacklo_epi8(load_rgba(col), zero);
+    const auto scales = _mm_set_epi16(
+        0, 0, 0, 0,
+        256, static_cast<short>(b_fixed), static_cast<short>(g_fixed), static_cast<short>(r_fixed)
+    );
+
+    return store_rgba(_mm_packus_epi16(scale_channels_u16(channels, scales), zero));
+#else
+    const unsigned int scales[4] = { r_fixed, g_fixed, b_fixed, 256 };
+
+    rgba ret;
+    for (auto i = 0; i < 4; i++)
+    {
+        const auto res = (static_cast<unsigned int>(col.e[i]) * scales[i]) >> 8;
+        ret.e[i] = static_cast<unsigned char>(res > 255 ? 255 : res);
+    }
+    return ret;
+#endif
+}
+
+inline rgba color_add(const rgba& lhs, const rgba& rhs)
+{
+#if USE_SSE2
+    return store_rgba(_mm_adds_epu8(load_rgba(lhs), load_rgba(rhs)));
+#else
+    rgba ret;
+    for (auto i = 0; i < 4; i++)
+    {
+        const auto res = lhs.e[i] + rhs.e[i];
+        ret.e[i] = static_cast<unsigned char>(res > 255 ? 255 : res);
+    }
+    return ret;
+#endif
+}
+
+inline rgba color_add_scalar(const rgba& col, const float amount)
+{
+    //channels are whole numbers, so flooring the amount matches flooring the float sum
+    auto whole = amount > 255.0f ? 255 : amount < -255.0f ? -255 : static_cast<int>(floorf(amount));
+
+#if USE_SSE2
+    if (whole >= 0)
+    {
+        return store_rgba(_mm_adds_epu8(load_rgba(col), _mm_set1_epi8(static_cast<char>(whole))));
+    }
+
+    return store_rgba(_mm_subs_epu8(load_rgba(col), _mm_set1_epi8(static_cast<char>(-whole))));
+#else
+    rgba ret;
+    for (auto i = 0; i < 4; i++)
+    {
+        auto res = col.e[i] + whole;
+        if (res > 255) res = 255;
+        if (res < 0) res = 0;
+        ret.e[i] = static_cast<unsigned char>(res);
+    }
+    return ret;
+#endif
+}
+
+inline rgba color_scale_add(const rgba& a, const float a_scale, const rgba& b, const float b_scale)
+{
+#if USE_SSE2
+    const auto a_fixed = static_cast<short>(color_scale_to_fixed(a_scale));
+    const auto b_fixed = static_cast<short>(color_scale_to_fixed(b_scale));
+
+    //a in the low four 16 bit lanes, b in the high four
+    const auto zero = _mm_setzero_si128();
+    const auto channels = _mm_unpacklo_epi8(_mm_unpacklo_epi32(load_rgba(a), load_rgba(b)), zero);
+    const auto scales = _mm_set_epi16(b_fixed, b_fixed, b_fixed, b_fixed, a_fixed, a_fixed, a_fixed, a_fixed);
+
+    const auto scaled = scale_channels_u16(channels, scales);
+
+    //the byte pack saturates the sum back to 0-255
+    return store_rgba(_mm_packus_epi16(_mm_add_epi16(scaled, _mm_srli_si128(scaled, 8)), zero));
+#else
+    return color_add(color_scale(a, a_scale), color_scale(b, b_scale));
+#endif
+}
+
+void color_scale_span(rgba* out, const rgba* in, const float scale, const int count)
+{
+    auto i = 0;
+
+#if USE_SSE2
+    const auto zero = _mm_setzero_si128();
+    const auto scales = _mm_set1_epi16(static_cast<short>(color_scale_to_fixed(scale)));
+
+    for (; i + 4 <= count; i += 4)
+    {
+        const auto pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+
+        const auto lo = scale_channels_u16(_mm_unpacklo_epi8(pixels, zero), scales);
+        const auto hi = scale_channels_u16(_mm_unpackhi_epi8(pixels, zero), scales);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        out[i] = color_scale(in[i], scale);
+    }
+}
+
+void color_add_span(rgba* out, const rgba* lhs, const rgba* rhs, const int count)
+{
+    auto i = 0;
+
+#if USE_SSE2
+    for (; i + 4 <= count; i += 4)
+    {
+        const auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lhs + i));
+        const auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs + i));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_adds_epu8(a, b));
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        out[i] = color_add(lhs[i], rhs[i]);
+    }
+}
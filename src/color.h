@@ -0,0 +1,30 @@
+#ifndef COLOR_H
+#define COLOR_H
+
+#include "image.h"
+
+/*
+ * Packed color arithmetic.
+ *
+ * Scale factors are converted to 8.8 fixed point and channels are combined with
+ * saturating integer ops, so results clamp to 0-255 like the original float code did.
+ * Each function works on all four channels (alpha included), and has an SSE2 path
+ * along with a scalar path that gives identical results.
+ */
+inline unsigned short color_scale_to_fixed(float scale);
+
+inline rgba color_scale(const rgba& col, float scale);
+inline rgba color_add(const rgba& lhs, const rgba& rhs);
+inline rgba color_add_scalar(const rgba& col, float amount);
+
+//scales the rgb channels by separate factors, alpha is left untouched
+inline rgba color_modulate(const rgba& col, const v3& rgb_scale);
+
+//saturate(a * a_scale + b * b_scale), the usual "lit color plus ambient" shader combination
+inline rgba color_scale_add(const rgba& a, float a_scale, const rgba& b, float b_scale);
+
+//versions of the above that process whole spans of pixels, 4 at a time
+void color_scale_span(rgba* out, const rgba* in, float scale, int count);
+void color_add_span(rgba* out, const rgba* lhs, const rgba* rhs, int count);
+
+#endif
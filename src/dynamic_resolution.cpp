@@ -0,0 +1,70 @@
+#include "dynamic_resolution.h"
+
+//scale changes in steps of 1/16, which keeps 512 pixel buffers on 32 pixel boundaries
+static const float resolution_scale_step = 1.0f / 16.0f;
+
+static const float frame_time_smoothing = 0.1f;
+static const float over_budget_threshold = 1.05f;
+static const float under_budget_threshold = 0.75f;
+static const int frames_before_scale_down = 10;
+static const int frames_before_scale_up = 60;
+
+void update_dynamic_resolution(dynamic_resolution& resolution, const float frame_ms)
+{
+    if (!resolution.enabled)
+    {
+        resolution.scale = 1.0f;
+        resolution.smoothed_frame_ms = frame_ms;
+        resolution.frames_over_budget = 0;
+        resolution.frames_under_budget = 0;
+        return;
+    }
+
+    resolution.smoothed_frame_ms += (frame_ms - resolution.smoothed_frame_ms) * frame_time_smoothing;
+
+    if (resolution.smoothed_frame_ms > resolution.target_frame_ms * over_budget_threshold)
+    {
+        resolution.frames_over_budget++;
+        resolution.frames_under_budget = 0;
+    }
+    else if (resolution.smoothed_frame_ms < resolution.target_frame_ms * under_budget_threshold)
+    {
+        resolution.frames_under_budget++;
+        resolution.frames_over_budget = 0;
+    }
+    else
+    {
+        //inside the dead band, leave the scale alone
+        resolution.frames_over_budget = 0;
+        resolution.frames_under_budget = 0;
+    }
+
+    if (resolution.frames_over_budget >= frames_before_scale_down)
+    {
+        resolution.scale -= resolution_scale_step;
+        if (resolution.scale < resolution.min_scale) resolution.scale = resolution.min_scale;
+
+        resolution.frames_over_budget = 0;
+    }
+    else if (resolution.frames_under_budget >= frames_before_scale_up)
+    {
+        resolution.scale += resolution_scale_step;
+        if (resolution.scale > 1.0f) resolution.scale = 1.0f;
+
+        resolution.frames_under_budget = 0;
+    }
+}
+
+v2_i scaled_render_size(const dynamic_resolution& resolution, const int full_width, const int full_height)
+{
+    //keep sizes a multiple of 4, so shading rate blocks line up
+    auto width = static_cast<int>(static_cast<float>(full_width) * resolution.scale) & ~3;
+    auto height = static_cast<int>(static_cast<float>(full_height) * resolution.scale) & ~3;
+
+    if (width < 16) width = 16;
+    if (height < 16) height = 16;
+    if (width > full_width) width = full_width;
+    if (height > full_height) height = full_height;
+
+    return { width, height };
+}
@@ -0,0 +1,30 @@
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include "maths.h"
+
+/*
+ * Picks a render scale that keeps frame time close to a target.
+ *
+ * Frame times are smoothed, and the scale only moves once the smoothed time has been
+ * outside of a dead band around the target for a number of frames. Stepping down is
+ * quicker than stepping back up, and the gap between the two thresholds is wider than
+ * the cost of a single step, so the scale settles instead of oscillating.
+ */
+struct dynamic_resolution
+{
+    bool enabled = false;
+
+    float target_frame_ms = 16.0f;
+    float min_scale = 0.5f;
+    float scale = 1.0f;
+
+    float smoothed_frame_ms{};
+    int frames_over_budget{};
+    int frames_under_budget{};
+};
+
+void update_dynamic_resolution(dynamic_resolution& resolution, float frame_ms);
+v2_i scaled_render_size(const dynamic_resolution& resolution, int full_width, int full_height);
+
+#endif
@@ -1,5 +1,6 @@
 #include <cstdio>
 #include <cstring>
+#include <vector>
 
 #include "file.h"
 #include "platform_specific.h"
@@ -172,7 +173,120 @@ void read_mesh(const char* path, mesh& out)
 }
 
 
-void load_models(const char* path, model* & output, int& model_count)
+//a single image decode, part of loading a model's textures
+struct texture_load_job
+{
+    const char* path;
+    texture* out;
+    texture_format format;
+};
+
+//lit meshes read all three maps per pixel, pack them together when their sizes match
+static void pack_mesh_textures(mesh& mesh)
+{
+    if(mesh.allow_lighting && mesh.has_normal_map && mesh.has_specular_map)
+    {
+        mesh.has_material_texture = build_material_texture(mesh.material, mesh.diffuse, mesh.normal, mesh.spec);
+
+        if(mesh.has_material_texture)
+        {
+            free_texture(mesh.diffuse);
+            free_texture(mesh.normal);
+            free_texture(mesh.spec);
+        }
+    }
+}
+
+/*
+ * Textures load in three batches of jobs: decoding every image, packing each mesh's
+ * maps, then block compressing every texture the meshes kept. Jobs within a batch
+ * touch separate textures, so they run in any order across the pool's threads.
+ */
+void load_model_textures(model& model, worker_pool& pool)
+{
+    std::vector<texture_load_job> decode_jobs;
+
+    for (size_t i = 0; i < model.mesh_count; i++)
+    {
+        auto& mesh = model.meshes[i];
+
+        //mesh maps are only read by shaders, so store them tiled for cache locality
+        decode_jobs.push_back({ mesh.diffuse_path, &mesh.diffuse, texture_format::rgba8 });
+
+        if(mesh.has_normal_map)
+        {
+            decode_jobs.push_back({ mesh.normal_path, &mesh.normal, texture_format::normal_xy8 });
+        }
+
+        if(mesh.has_specular_map)
+        {
+            decode_jobs.push_back({ mesh.specular_path, &mesh.spec, texture_format::rgba8 });
+        }
+
+        if(mesh.has_emissive_map)
+        {
+            decode_jobs.push_back({ mesh.emission_path, &mesh.emission, texture_format::rgba8 });
+        }
+    }
+
+    parallel_for(pool, static_cast<int>(decode_jobs.size()), [&](const int job_idx) {
+        const auto& job = decode_jobs[job_idx];
+        load_texture(job.path, *job.out, texture_layout::tiled, job.format);
+    });
+
+    parallel_for(pool, static_cast<int>(model.mesh_count), [&](const int mesh_idx) {
+        pack_mesh_textures(model.meshes[mesh_idx]);
+    });
+
+    //block compress everything the meshes keep, samplers decode blocks on the fly
+    static const int textures_per_mesh = 5;
+
+    parallel_for(pool, static_cast<int>(model.mesh_count) * textures_per_mesh, [&](const int job_idx) {
+        auto& mesh = model.meshes[job_idx / textures_per_mesh];
+        texture* textures[textures_per_mesh] = { &mesh.diffuse, &mesh.normal, &mesh.spec, &mesh.emission, &mesh.material };
+
+        compress_texture(*textures[job_idx % textures_per_mesh]);
+    });
+
+    model.textures_resident = true;
+}
+
+void free_model_textures(model& model)
+{
+    for (size_t i = 0; i < model.mesh_count; i++)
+    {
+        auto& mesh = model.meshes[i];
+
+        free_texture(mesh.diffuse);
+        free_texture(mesh.normal);
+        free_texture(mesh.spec);
+        free_texture(mesh.emission);
+        free_texture(mesh.material);
+        mesh.has_material_texture = false;
+    }
+
+    model.textures_resident = false;
+}
+
+size_t model_texture_memory_size(const model& model)
+{
+    size_t size = 0;
+
+    for (size_t i = 0; i < model.mesh_count; i++)
+    {
+        const auto& mesh = model.meshes[i];
+
+        size += texture_memory_size(mesh.diffuse);
+        size += texture_memory_size(mesh.normal);
+        size += texture_memory_size(mesh.spec);
+        size += texture_memory_size(mesh.emission);
+        size += texture_memory_size(mesh.material);
+    }
+
+    return size;
+}
+
+void load_models(const char* path, model* & output, int& model_count, worker_pool& pool)
 {
     FILE * f = nullptr;
     open_binary_file(path, f);
@@ -184,6 +298,9 @@ void load_models(const char* path, model* & output, int& model_count)
     output = new model[model_count];
     assert(output != nullptr);
 
+    //geometry is read once the whole file is parsed, as a batch of jobs
+    std::vector<mesh*> geometry_jobs;
+
     for (auto i = 0; i < model_count; i++)
     {
         auto& model = output[i];
@@ -226,34 +343,24 @@ void load_models(const char* path, model* & output, int& model_count)
             mesh.has_normal_map = mesh.normal_path != nullptr && strlen(mesh.normal_path) > 0;
 
             mesh.specular_path = read_string_checked(f);
-            mesh.has_specular_map = mesh.specular_path != nullptr && strlen(mesh.normal_path) > 0;
+            mesh.has_specular_map = mesh.specular_path != nullptr && strlen(mesh.specular_path) > 0;
 
             mesh.emission_path = read_string_checked(f);
-            mesh.has_emissive_map = mesh.emission_path != nullptr && strlen(mesh.normal_path) > 0;
-
-            //load the referenced resources
-            char model_bin_path[1024];
-            concat_strings( strlen(mesh.geo_path), mesh.geo_path, strlen(".bin"), ".bin", model_bin_path);
-            
-            read_mesh(model_bin_path, mesh);
-            load_image(mesh.diffuse_path, mesh.diffuse);
-
-            if(mesh.has_normal_map)
-            {
-                load_image(mesh.normal_path, mesh.normal);
-            }
-
-            if(mesh.has_specular_map)
-            {
-                load_image(mesh.specular_path, mesh.spec);
-            }
-
-            if(mesh.has_emissive_map)
-            {
-                load_image(mesh.emission_path, mesh.emission);
-            }
+            mesh.has_emissive_map = mesh.emission_path != nullptr && strlen(mesh.emission_path) > 0;
+
+            geometry_jobs.push_back(&mesh);
         }
     }
 
     fclose(f);
+
+    //load the referenced resources
+    parallel_for(pool, static_cast<int>(geometry_jobs.size()), [&](const int job_idx) {
+        auto& mesh = *geometry_jobs[job_idx];
+
+        char model_bin_path[1024];
+        concat_strings( strlen(mesh.geo_path), mesh.geo_path, strlen(".bin"), ".bin", model_bin_path);
+
+        read_mesh(model_bin_path, mesh);
+    });
 }
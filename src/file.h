@@ -3,7 +3,9 @@
 
 #include "maths.h"
 #include "image.h"
+#include "texture.h"
 #include "render.h"
+#include "worker_pool.h"
 
 struct face
 {
@@ -14,15 +16,19 @@ struct face
 
 struct mesh
 {    
-    image diffuse;
-    image normal;
-    image spec;
-    image emission;
+    texture diffuse;
+    texture normal;
+    texture spec;
+    texture emission;
+
+    //diffuse, normal and specular maps interleaved, replaces them when has_material_texture is set
+    texture material;
 
     bool allow_lighting{};
     bool has_emissive_map{};
     bool has_normal_map{};
     bool has_specular_map{};
+    bool has_material_texture{};
 
     const char* geo_path{};
     const char* diffuse_path{};
@@ -53,10 +59,20 @@ struct model
     const char * name{};
     const char * url{};
 
+    //texture residency, textures are decoded on demand and may be evicted, see texture_residency.h
+    bool textures_resident{};
+    size_t texture_bytes{};
+    unsigned long long last_used{};
+
     inline int get_face_count() const;
 };
 
 
-void load_models(const char* path, model*& output, int& model_count);
+//reads model descriptions and geometry, textures are loaded separately by load_model_textures
+void load_models(const char* path, model*& output, int& model_count, worker_pool& pool);
+
+void load_model_textures(model& model, worker_pool& pool);
+void free_model_textures(model& model);
+size_t model_texture_memory_size(const model& model);
 
 #endif
\ No newline at end of file
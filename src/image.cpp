@@ -1,4 +1,5 @@
 #include "image.h"
+#include "color.h"
 
 #include <cassert>
 #include <algorithm>
@@ -6,47 +7,23 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "include/stb_image.h"
 
+/*
+    The rgba operators are thin wrappers around the packed color
+    functions in color.cpp, see there for the saturation rules.
+*/
 rgba rgba::operator * (const float rhs) const
 {
-    rgba ret{};
-    for (auto y = 0; y < 4; y++) {
-        auto mult = static_cast<float>(e[y]) * rhs;
-
-        if (mult > 255) mult = 255;
-        if (mult < 0) mult = 0;
-
-        ret.e[y] = static_cast<unsigned char>(mult);
-    }
-    return ret;
+    return color_scale(*this, rhs);
 }
 
 rgba rgba::operator + (const float rhs) const
 {
-    rgba ret{};
-    for (auto y = 0; y < 4; y++) {
-        auto res = static_cast<float>(e[y]) + rhs;
-
-        if (res > 255) res = 255;
-        if (res < 0) res = 0;
-
-        ret.e[y] = static_cast<unsigned char>(res);
-    }
-    return ret;
+    return color_add_scalar(*this, rhs);
 }
 
 rgba rgba::operator + (const rgba& rhs) const
 {
-    rgba ret{};
-
-    for (auto y = 0; y < 4; y++) {
-        auto res = e[y] + rhs.e[y];
-
-        if (res > 255) res = 255;
-        if (res < 0) res = 0;
-
-        ret.e[y] = static_cast<unsigned char>(res);
-    }
-    return ret;
+    return color_add(*this, rhs);
 }
 
 /*
@@ -155,13 +132,46 @@ int image::stride() const
     return width * n_channels;
 }
 
+inline image_view make_image_view(const image& img, const image_origin origin)
+{
+    //only support rgba images
+    assert(img.n_channels == 4);
+
+    image_view view{};
+    view.width = img.width;
+    view.height = img.height;
+    view.n_channels = img.n_channels;
+    view.origin = origin;
+
+    if (origin == image_origin::top_left)
+    {
+        view.first_row = img.data;
+        view.pitch = img.stride();
+    }
+    else
+    {
+        view.first_row = img.data + (img.height - 1) * img.stride();
+        view.pitch = -img.stride();
+    }
+
+    return view;
+}
+
+inline rgba* image_view::row(const int y) const
+{
+    //bounds are checked per row, callers keep x inside the width
+    assert(y >= 0 && y < height);
+
+    return reinterpret_cast<rgba*>(first_row + y * pitch);
+}
+
 inline void set_pixel(image& out, const rgba& col, int x, int y)
 {
     //only support rgba images
     assert(out.n_channels == 4);
 
     //read from bottom up
-    y = out.width - y - 1;	
+    y = out.height - y - 1;
 
     const auto idx = (y * out.width + x);
     const auto max_size = out.width * out.height;
@@ -52,6 +52,37 @@ struct image {
     int stride() const;
 };
 
+/*
+ * Which row of an image a view numbers as row 0.
+ *
+ *  bottom_left - the bottom row, the convention of get_pixel/set_pixel and of screen space.
+ *  top_left    - the top row, the order rows are stored in.
+ */
+enum class image_origin
+{
+    bottom_left,
+    top_left,
+};
+
+/*
+ * Row addressed view of an rgba image. The view holds a pointer to its row 0 and the
+ * pitch in bytes between its rows, which is negative for bottom up views, so the flip
+ * is paid once when the view is made. Hot loops fetch a row pointer once per row and
+ * index it with x, instead of calling get_pixel/set_pixel for every pixel.
+ */
+struct image_view
+{
+    unsigned char* first_row{};
+    int width{}, height{};
+    int pitch{};
+    int n_channels = 4;
+    image_origin origin = image_origin::bottom_left;
+
+    inline rgba* row(int y) const;
+};
+
+inline image_view make_image_view(const image& img, image_origin origin = image_origin::bottom_left);
+
 inline void set_pixel(image& out, const rgba& col, int x, int y);
 inline rgba get_pixel(image& out, int x, int y);
 inline v3 get_normal(image& out, int x, int y);
@@ -0,0 +1,349 @@
+#include <cmath>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+
+#include "lighting.h"
+#include "render.h"
+
+static const int specular_base_exponent = 5;
+static const int specular_lut_rows = 256;
+static const int specular_lut_columns = 128;
+
+/*
+ * One row per specular map texel value, each holding pow(x, 5 + texel) sampled
+ * at evenly spaced values of u = sqrt(1 - x). Sampling in u rather than x puts most
+ * of the columns close to x = 1, where high exponent curves fall off sharply.
+ *
+ * Values are stored as 16 bit fixed point to keep the table small (~66kb).
+ */
+static unsigned short specular_lut[specular_lut_rows][specular_lut_columns + 1];
+static bool specular_lut_initialised = false;
+
+const char* specular_quality_name(const specular_quality quality)
+{
+    switch (quality)
+    {
+    case specular_quality::exact: return "Exact";
+    case specular_quality::lookup_table: return "Lookup Table";
+    case specular_quality::fast_pow: return "Fast Pow";
+    }
+
+    return "";
+}
+
+void init_specular_lookup_table()
+{
+    if (specular_lut_initialised) return;
+
+    for (auto row = 0; row < specular_lut_rows; row++)
+    {
+        const auto exponent = static_cast<double>(specular_base_exponent + row);
+
+        for (auto column = 0; column <= specular_lut_columns; column++)
+        {
+            const auto u = static_cast<double>(column) / specular_lut_columns;
+            const auto x = 1.0 - u * u;
+
+            specular_lut[row][column] = static_cast<unsigned short>(lround(pow(x, exponent) * 65535.0));
+        }
+    }
+
+    specular_lut_initialised = true;
+}
+
+/*
+ * log2 approximation for positive, normal floats. The exponent bits give the integer
+ * part, a degree 6 polynomial fitted to log2(1 + t) on [0, 1) gives the mantissa part.
+ *
+ * Max absolute error ~3e-6.
+ */
+inline float fast_log2(const float x)
+{
+    unsigned int bits;
+    memcpy(&bits, &x, sizeof(bits));
+
+    const auto exponent = static_cast<float>(static_cast<int>(bits >> 23) - 127);
+
+    //rebuild the mantissa as a float in the range [1, 2)
+    bits = (bits & 0x007fffff) | 0x3f800000;
+    float mantissa;
+    memcpy(&mantissa, &bits, sizeof(mantissa));
+
+    const auto t = mantissa - 1.0f;
+
+    return exponent + t * (1.4425449f + t * (-0.7181452f + t * (0.4575485f + t * (-0.2779042f + t * (0.1217970f + t * -0.0258411f)))));
+}
+
+/*
+ * exp2 approximation. The integer part of x is written straight into the exponent
+ * bits, a degree 5 polynomial handles the fractional part. Inputs are clamped to
+ * the normal float range, which flushes tiny results to ~1e-38 rather than zero.
+ *
+ * Max relative error ~9e-5.
+ */
+inline float fast_exp2(float x)
+{
+    if (x < -126.0f) x = -126.0f;
+
+    const auto integer_part = floorf(x);
+    const auto f = x - integer_part;
+
+    const auto fraction = 1.0f + f * (0.6931472f + f * (0.2402265f + f * (0.0555041f + f * (0.0096181f + f * 0.0013333f))));
+
+    const auto bits = static_cast<unsigned int>(static_cast<int>(integer_part) + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+
+    return scale * fraction;
+}
+
+/*
+ * pow for bases in (0, 1] and positive exponents, as used by specular highlights.
+ * There are no branches or table lookups, so loops over it can be auto-vectorized.
+ */
+inline float fast_pow(const float base, const float exponent)
+{
+    //keep log2 away from zero and denormals
+    const auto safe_base = base < 1e-30f ? 1e-30f : base;
+
+    return fast_exp2(exponent * fast_log2(safe_base));
+}
+
+inline float specular_power(float cos_angle, const unsigned char exponent_texel, const specular_quality quality)
+{
+    if (cos_angle < 0) cos_angle = 0;
+    if (cos_angle > 1) cos_angle = 1;
+
+    switch (quality)
+    {
+    case specular_quality::lookup_table: {
+        const auto u = sqrtf(1.0f - cos_angle) * specular_lut_columns;
+
+        auto column = static_cast<int>(u);
+        if (column > specular_lut_columns - 1) column = specular_lut_columns - 1;
+
+        const auto t = u - static_cast<float>(column);
+        const auto* row = specular_lut[exponent_texel];
+
+        const auto a = static_cast<float>(row[column]);
+        const auto b = static_cast<float>(row[column + 1]);
+
+        return (a + (b - a) * t) * (1.0f / 65535.0f);
+    }
+
+    case specular_quality::fast_pow:
+        return fast_pow(cos_angle, static_cast<float>(specular_base_exponent + exponent_texel));
+
+    case specular_quality::exact:
+    default:
+        return static_cast<float>(pow(cos_angle, specular_base_exponent + exponent_texel));
+    }
+}
+
+inline const unsigned short* light_tile_grid::tile_lights(const int x, const int y, int& count) const
+{
+    const auto tile_x = x / light_tile_size;
+    const auto tile_y = y / light_tile_size;
+
+    if (tile_x < 0 || tile_x >= tiles_x || tile_y < 0 || tile_y >= tiles_y)
+    {
+        count = 0;
+        return nullptr;
+    }
+
+    const auto idx = tile_y * tiles_x + tile_x;
+
+    count = light_counts[idx];
+    return light_indices + idx * max_lights_per_tile;
+}
+
+static void resize_light_tiles(light_tile_grid& grid, const int width, const int height)
+{
+    const auto tiles_x = (width + light_tile_size - 1) / light_tile_size;
+    const auto tiles_y = (height + light_tile_size - 1) / light_tile_size;
+
+    if (grid.tiles_x == tiles_x && grid.tiles_y == tiles_y) return;
+
+    delete[] grid.light_counts;
+    delete[] grid.light_indices;
+    delete[] grid.min_depths;
+    delete[] grid.max_depths;
+
+    const auto tile_count = tiles_x * tiles_y;
+
+    grid.tiles_x = tiles_x;
+    grid.tiles_y = tiles_y;
+    grid.light_counts = new int[tile_count];
+    grid.light_indices = new unsigned short[tile_count * max_lights_per_tile];
+    grid.min_depths = new float[tile_count];
+    grid.max_depths = new float[tile_count];
+    assert(grid.light_counts != nullptr && grid.light_indices != nullptr);
+    assert(grid.min_depths != nullptr && grid.max_depths != nullptr);
+}
+
+/*
+ * Builds the per tile light lists. Must run after depth has been rasterized.
+ *
+ * The z buffer stores rows top down, while tiles (and fragment screen positions)
+ * are addressed bottom up, so rows are flipped when gathering the tile depth ranges.
+ * Lights are bounded by the screen space rectangle of their bounding box corners,
+ * which is conservative but cheap enough to do for hundreds of lights.
+ */
+void build_light_tiles(render_state& state)
+{
+    auto& grid = state.light_tiles;
+    const auto& frame_buffer = state.output_buffers.frame_buffer;
+    const auto* z_buffer = state.output_buffers.z_buffer;
+
+    const auto width = frame_buffer.width;
+    const auto height = frame_buffer.height;
+
+    resize_light_tiles(grid, width, height);
+
+    const auto tile_count = grid.tiles_x * grid.tiles_y;
+
+    for (auto i = 0; i < tile_count; i++)
+    {
+        grid.light_counts[i] = 0;
+        grid.min_depths[i] = 1e30f;
+        grid.max_depths[i] = -1e30f;
+    }
+
+    //gather depth ranges of covered pixels
+    for (auto y = 0; y < height; y++)
+    {
+        const auto* z_row = z_buffer + (height - 1 - y) * width;
+        auto* tile_min = grid.min_depths + (y / light_tile_size) * grid.tiles_x;
+        auto* tile_max = grid.max_depths + (y / light_tile_size) * grid.tiles_x;
+
+        for (auto x = 0; x < width; x++)
+        {
+            const auto z = z_row[x];
+            if (!(z > min_z_buffer_val)) continue;
+
+            const auto tile_x = x / light_tile_size;
+            if (z < tile_min[tile_x]) tile_min[tile_x] = z;
+            if (z > tile_max[tile_x]) tile_max[tile_x] = z;
+        }
+    }
+
+    const auto screen_transform = state.viewport * state.projection;
+
+    for (auto light_idx = 0; light_idx < state.light_count && light_idx < max_lights; light_idx++)
+    {
+        const auto& light = state.lights[light_idx];
+        const auto r = light.radius;
+
+        //screen space bounds of the light's bounding box
+        auto min_x = 1e30f, min_y = 1e30f;
+        auto max_x = -1e30f, max_y = -1e30f;
+        auto covers_screen = false;
+
+        for (auto corner = 0; corner < 8; corner++)
+        {
+            const v3 corner_pos{
+                light.position.x + (corner & 1 ? r : -r),
+                light.position.y + (corner & 2 ? r : -r),
+                light.position.z + (corner & 4 ? r : -r),
+            };
+
+            const auto screen = screen_transform * project_4d(corner_pos);
+
+            //corner is behind the camera, can't bound the light on screen
+            if (screen.w < 1e-3f)
+            {
+                covers_screen = true;
+                break;
+            }
+
+            const auto sx = screen.x / screen.w;
+            const auto sy = screen.y / screen.w;
+
+            if (sx < min_x) min_x = sx;
+            if (sx > max_x) max_x = sx;
+            if (sy < min_y) min_y = sy;
+            if (sy > max_y) max_y = sy;
+        }
+
+        auto tile_min_x = 0, tile_max_x = grid.tiles_x - 1;
+        auto tile_min_y = 0, tile_max_y = grid.tiles_y - 1;
+
+        if (!covers_screen)
+        {
+            if (max_x < 0 || max_y < 0 || min_x >= width || min_y >= height) continue;
+
+            tile_min_x = std::max(0, static_cast<int>(min_x) / light_tile_size);
+            tile_max_x = std::min(grid.tiles_x - 1, static_cast<int>(max_x) / light_tile_size);
+            tile_min_y = std::max(0, static_cast<int>(min_y) / light_tile_size);
+            tile_max_y = std::min(grid.tiles_y - 1, static_cast<int>(max_y) / light_tile_size);
+        }
+
+        const auto light_min_z = light.position.z - r;
+        const auto light_max_z = light.position.z + r;
+
+        for (auto tile_y = tile_min_y; tile_y <= tile_max_y; tile_y++)
+        {
+            for (auto tile_x = tile_min_x; tile_x <= tile_max_x; tile_x++)
+            {
+                const auto idx = tile_y * grid.tiles_x + tile_x;
+
+                //skips empty tiles too, their depth range is inverted
+                if (light_max_z < grid.min_depths[idx] || light_min_z > grid.max_depths[idx]) continue;
+
+                auto& count = grid.light_counts[idx];
+                if (count >= max_lights_per_tile) continue;
+
+                grid.light_indices[idx * max_lights_per_tile + count] = static_cast<unsigned short>(light_idx);
+                count++;
+            }
+        }
+    }
+}
+
+inline v3 shade_lights(const render_state& state, const v3& position, v3 normal, const v2_i& screen_pos)
+{
+    v3 total{};
+
+    auto count = 0;
+    const auto* indices = state.light_tiles.tile_lights(screen_pos.x, screen_pos.y, count);
+
+    for (auto i = 0; i < count; i++)
+    {
+        const auto& light = state.lights[indices[i]];
+
+        auto to_light = light.position - position;
+        const auto dist_sq = to_light.inner(to_light);
+
+        if (dist_sq >= light.radius * light.radius || dist_sq <= 0) continue;
+
+        const auto dist = sqrtf(dist_sq);
+        auto dir = to_light / dist;
+
+        const auto n_dot_l = normal.inner(dir);
+        if (n_dot_l <= 0) continue;
+
+        //smooth falloff to zero at the light radius
+        const auto falloff = 1.0f - dist / light.radius;
+        auto attenuation = falloff * falloff;
+
+        if (light.type == light_type::spot)
+        {
+            auto spot_dir = light.direction;
+            const auto cos_angle = -spot_dir.inner(dir);
+
+            if (cos_angle <= light.cos_outer_cone) continue;
+
+            const auto cone_range = light.cos_inner_cone - light.cos_outer_cone;
+
+            auto t = cone_range > 0 ? (cos_angle - light.cos_outer_cone) / cone_range : 1.0f;
+            if (t > 1) t = 1;
+
+            attenuation *= t * t * (3.0f - 2.0f * t);
+        }
+
+        total = total + light.color * (n_dot_l * attenuation);
+    }
+
+    return total;
+}
@@ -0,0 +1,94 @@
+#ifndef LIGHTING_H
+#define LIGHTING_H
+
+#include "maths.h"
+#include "image.h"
+
+/*
+ * Specular highlights are evaluated as pow(cos_angle, 5 + spec_texel), where the
+ * exponent comes from the blue channel of a mesh specular map. A call to pow()
+ * per lit pixel is expensive, so shaders can pick from the evaluation methods below.
+ *
+ *  exact        - calls powf(), reference quality.
+ *  lookup_table - bilinear lookup into a 2D table indexed by exponent texel and
+ *                 sqrt(1 - cos_angle). Max absolute error is ~0.004 (about one 8-bit color step).
+ *  fast_pow     - branchless exp2(exponent * log2(cos_angle)) polynomial approximation.
+ *                 Max absolute error is ~1e-4 over the full exponent range.
+ */
+enum class specular_quality
+{
+    exact,
+    lookup_table,
+    fast_pow,
+};
+
+static const int specular_quality_count = 3;
+
+const char* specular_quality_name(specular_quality quality);
+
+void init_specular_lookup_table();
+
+inline float fast_log2(float x);
+inline float fast_exp2(float x);
+inline float fast_pow(float base, float exponent);
+
+inline float specular_power(float cos_angle, unsigned char exponent_texel, specular_quality quality);
+
+/*
+ * Dynamic point and spot lights, positioned in view space.
+ *
+ * Lights only affect surfaces within their radius. Spot lights additionally
+ * fade out between the inner and outer cone angles around their direction.
+ */
+enum class light_type
+{
+    point,
+    spot,
+};
+
+struct light
+{
+    light_type type{};
+    v3 position{};
+    v3 direction{};
+    v3 color{};
+
+    float radius = 1;
+    float cos_inner_cone = 1;
+    float cos_outer_cone = 0;
+};
+
+static const int max_lights = 256;
+
+/*
+ * Screen space light culling. The screen is split into 16x16 pixel tiles, and each
+ * tile stores the indices of the lights whose bounding sphere overlaps both the
+ * tile's screen rectangle and the depth range of the geometry in the tile.
+ *
+ * Tiles keep at most max_lights_per_tile lights, any extra lights are dropped.
+ */
+static const int light_tile_size = 16;
+static const int max_lights_per_tile = 64;
+
+struct light_tile_grid
+{
+    int tiles_x{};
+    int tiles_y{};
+
+    int* light_counts{};
+    unsigned short* light_indices{};
+
+    //depth range of the rendered geometry in each tile
+    float* min_depths{};
+    float* max_depths{};
+
+    inline const unsigned short* tile_lights(int x, int y, int& count) const;
+};
+
+struct render_state;
+void build_light_tiles(render_state& state);
+
+//accumulated diffuse light color at a view space position
+inline v3 shade_lights(const render_state& state, const v3& position, v3 normal, const v2_i& screen_pos);
+
+#endif
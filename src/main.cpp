@@ -10,10 +10,20 @@
     Unity build
 */
 #include "platform_specific.cpp"
+#include "worker_pool.cpp"
 #include "maths.cpp"
+#include "lighting.cpp"
+#include "color.cpp"
 #include "image.cpp"
+#include "block_compression.cpp"
+#include "texture.cpp"
+#include "sampler.cpp"
 #include "file.cpp"
+#include "texture_residency.cpp"
+#include "shading_rate.cpp"
 #include "render.cpp"
+#include "dynamic_resolution.cpp"
+#include "shadow.cpp"
 #include "shaders.cpp"
 #include "ui.cpp"
 
@@ -35,19 +45,43 @@ static shader * shaders[shader_count] = {
 static jumbo_pixels jumbo_pixels;
 static chromatic_aberration chromatic_aberration;
 static sobel_filter sobel_filter;
-static const int screen_space_effect_count = 3;
+static bloom bloom;
+static ambient_occlusion ambient_occlusion;
+static fxaa fxaa;
+static const int screen_space_effect_count = 6;
 static screen_space_effect* screen_space_effects[screen_space_effect_count] = {
     &chromatic_aberration,
     & sobel_filter,
     &jumbo_pixels,
+    &bloom,
+    &ambient_occlusion,
+    &fxaa,
 };
 
+/*
+    Dynamic Lights
+*/
+static light scene_lights[max_lights];
+
+/*
+    Directional Shadows
+*/
+static shadow_map scene_shadow_map;
+
+/*
+    Worker Threads
+*/
+static worker_pool workers;
+
 /*
     Model Buffer
 */
 static int model_count;
 static model * models;
 
+//decoded textures of the models, loaded on selection and evicted to fit a budget
+static texture_residency model_textures;
+
 struct application_state
 {
     render_state gl_state;
@@ -59,12 +93,23 @@ struct application_state
     shader* active_shader{};
     int active_shader_idx{};
 
-    screen_space_effect* active_effect{};
-    int active_effect_idx{};
+    //screen space effects, applied in order when use_fx is set
+    effect_chain effects{};
+    int selected_effect{};
 
     bool running{};
     bool use_fx = false;
 
+    //animated point/spot lights orbiting the model
+    bool use_point_lights = false;
+    int point_light_count = 64;
+
+    //shadow map from the directional light
+    bool use_shadows = false;
+
+    //render scale driven by frame time
+    dynamic_resolution resolution{};
+
     //active model rotation/transform
     v3 target_rot{};
     v3 target_trans{};
@@ -83,6 +128,7 @@ SDL_Surface* global_screen_surface = nullptr;
 application_state global_app_state;
 
 static int main_loop(application_state & app_state, SDL_Window* window, SDL_Surface* screen_surface);
+static m4 render_view_port(int width, int height);
 
 //emscripten main loop
 #ifdef EMSCRIPTEN
@@ -102,8 +148,45 @@ int main(int argc, char* args[]) {
     image letter_sampler{};
     assert(load_image("./obj/courier_new.png", letter_sampler));
 
-    /* Load the models */
-    load_models("./obj/conf.bin", models, model_count);
+    /* Build shading lookup tables */
+    init_specular_lookup_table();
+
+    /* Start the worker threads, --threads N overrides the count */
+    auto worker_count = default_worker_count();
+    for (auto i = 1; i + 1 < argc; i++)
+    {
+        if (strcmp(args[i], "--threads") == 0) worker_count = atoi(args[i + 1]);
+    }
+    init_worker_pool(workers, worker_count);
+
+    /* Load the models, and decode the textures of the first one */
+    const auto load_start = std::chrono::high_resolution_clock::now();
+
+    load_models("./obj/conf.bin", models, model_count, workers);
+    make_model_resident(model_textures, workers, models, model_count, 0);
+
+    const auto load_end = std::chrono::high_resolution_clock::now();
+    printf("Loaded models in %.1fms with %d worker threads\n",
+        std::chrono::duration<double, std::milli>(load_end - load_start).count(), workers.thread_count);
+
+    /* Texture layout benchmark, run with --bench-textures */
+    for (auto i = 1; i < argc; i++)
+    {
+        if (strcmp(args[i], "--bench-textures") == 0)
+        {
+            for (auto j = 0; j < model_count; j++)
+            {
+                printf("%s\n", models[j].name);
+                make_model_resident(model_textures, workers, models, model_count, j);
+
+                const auto& mesh = models[j].meshes[0];
+                benchmark_texture_layouts(mesh.has_material_texture ? mesh.material : mesh.diffuse);
+            }
+
+            shutdown_worker_pool(workers);
+            return 0;
+        }
+    }
 
     const auto render_width = 512;
     const auto render_height = 512;
@@ -118,12 +201,7 @@ int main(int argc, char* args[]) {
             v3{ 1, 1, 1 }.normalise(),
             identity(),
             projection(v3{ 0, 0, 3 }, v3{ 0, 0, 0 }),
-            view_port(
-                static_cast<float>(render_width) / 10,
-                static_cast<float>(render_height) / 10,
-                static_cast<float>(render_width) * 4 / 5,
-                static_cast<float>(render_height) * 4 / 5
-            )
+            render_view_port(render_width, render_height)
         },
         //ui state
         {
@@ -134,14 +212,22 @@ int main(int argc, char* args[]) {
         &models[0], 0,
         //active shader
         shaders[0], 0,
-        //active screen space effect
-        screen_space_effects[0], 0,
     };
 
+    /* Start the effect chain with a single effect */
+    global_app_state.effects.effects[0] = screen_space_effects[0];
+    global_app_state.effects.count = 1;
+
+    /* Screen space effects share the loader's worker threads */
+    global_app_state.gl_state.workers = &workers;
+
     /* Initialise output buffers. The width/height values specified here determine rendering resolution */
     init_output_buffers(global_app_state.gl_state.output_buffers, render_width, render_height);
     printf("Rendering with Width:%d and Height:%d\n", render_width, render_height);
 
+    /* Initialise the shadow map render target */
+    init_shadow_map(scene_shadow_map, 512);
+
 
     /* Setup initial model position and app background color */
     global_app_state.target_rot = global_app_state.active_model->initial_rot;
@@ -189,12 +275,19 @@ int main(int argc, char* args[]) {
         }
     }
 
+#ifndef EMSCRIPTEN
+    //the emscripten main loop keeps running after main returns, along with the workers
+    shutdown_worker_pool(workers);
+#endif
+
     return 0;
 }
 
 static void draw_ui(application_state & app_state);
 static void poll_events(application_state& app_state);
 static void update_application_colors(application_state& app_state);
+static void update_scene_lights(application_state& app_state);
+static void update_render_size(application_state& app_state);
 static void draw_scene(application_state & app_state, SDL_Surface* screen_surface);
 static void copy_frame_buffer_to_screen(application_state& app_state, SDL_Surface* screen_surface);
 
@@ -220,15 +313,27 @@ static int main_loop(application_state & app_state, SDL_Window* window, SDL_Surf
     //update the application color theme
     update_application_colors(app_state);
 
+    //animate dynamic lights
+    update_scene_lights(app_state);
+
+    //pick the render size for this frame
+    update_render_size(app_state);
+
     //render the scene
     draw_scene(app_state, screen_surface);
 
-    //apply active screen space effect if enabled
+    //pick shading rates for next frame from this frame's output
+    update_shading_rates(app_state.gl_state);
+
+    //apply the screen space effect chain if enabled
     if(app_state.use_fx)
     {
-        apply_screen_space_effect(*app_state.active_effect, app_state.gl_state);
+        apply_effect_chain(app_state.effects, app_state.gl_state);
     }
 
+    //scale a reduced size render back up, before the ui is drawn at full resolution
+    upscale_to_full_size(app_state.gl_state.output_buffers);
+
     //render the user interface if we aren't about to sleep
     if (!app_state.impending_sleep)
     {
@@ -253,6 +358,8 @@ static int main_loop(application_state & app_state, SDL_Window* window, SDL_Surf
     app_state.gl_state.dt = frame_duration_seconds;
     app_state.gl_state.culm_dt += frame_duration_seconds;
 
+    update_dynamic_resolution(app_state.resolution, frame_duration_seconds);
+
     return 0;
 }
 
@@ -260,7 +367,7 @@ static void poll_events(application_state & app_state)
 {
     SDL_GetMouseState(&app_state.ui_state.mouse_x, &app_state.ui_state.mouse_y);
     //invert mouse y - want bottom left to be window origin (matches output buffers)
-    app_state.ui_state.mouse_y = app_state.gl_state.output_buffers.frame_buffer.height - app_state.ui_state.mouse_y;
+    app_state.ui_state.mouse_y = app_state.gl_state.output_buffers.full_height - app_state.ui_state.mouse_y;
 
     //reset mouse down state for this frame
     app_state.ui_state.mouse_down_this_frame = false;
@@ -325,14 +432,27 @@ static void poll_events(application_state & app_state)
 static void draw_scene(application_state & app_state, SDL_Surface* screen_surface)
 {
     //apply model transform
+    app_state.gl_state.model_matrix = rot_x(app_state.target_rot.x)
+                                      * rot_y(app_state.target_rot.y)
+                                      * trans(app_state.target_trans);
+
     app_state.gl_state.model_view = look_at(
                                         app_state.gl_state.eye,
                                         app_state.gl_state.center,
                                         app_state.gl_state.up
                                     )
-                                    * rot_x(app_state.target_rot.x)
-                                    * rot_y(app_state.target_rot.y)
-                                    * trans(app_state.target_trans);
+                                    * app_state.gl_state.model_matrix;
+
+    //update the shadow map, this is a no-op unless the light or model moved
+    if (app_state.use_shadows)
+    {
+        update_shadow_map(scene_shadow_map, *app_state.active_model, app_state.gl_state);
+        app_state.gl_state.shadows = &scene_shadow_map;
+    }
+    else
+    {
+        app_state.gl_state.shadows = nullptr;
+    }
 
     //render the model
     draw_model(*app_state.active_model, app_state.gl_state, *app_state.active_shader);
@@ -350,6 +470,16 @@ static int alter_idx_wrapped(int index, const int mod_amount, const int max)
     return index;
 }
 
+static int effect_index(const screen_space_effect* effect)
+{
+    for (auto i = 0; i < screen_space_effect_count; i++)
+    {
+        if (screen_space_effects[i] == effect) return i;
+    }
+
+    return 0;
+}
+
 static void draw_ui(application_state& app_state)
 {
     auto& output = app_state.gl_state.output_buffers;
@@ -371,6 +501,65 @@ static void draw_ui(application_state& app_state)
     //smooth shading toggle
     labeled_toggle(ui_draw_position, ui_state, output, "Smooth Shading", app_state.gl_state.smooth_shading);
 
+    //dynamic light toggle and count
+    if (app_state.use_point_lights)
+    {
+        int_selector(ui_draw_position, output, ui_state, app_state.point_light_count, 16);
+        increment_col(ui_draw_position, ui_state);
+        blit_string(ui_draw_position, "Light Count", ui_state, output, ui_state.text_col);
+        increment_row(ui_draw_position, ui_state);
+
+        if (app_state.point_light_count < 0) app_state.point_light_count = 0;
+        if (app_state.point_light_count > max_lights) app_state.point_light_count = max_lights;
+    }
+
+    labeled_toggle(ui_draw_position, ui_state, output, "Point Lights", app_state.use_point_lights);
+
+    //shadow toggle
+    labeled_toggle(ui_draw_position, ui_state, output, "Shadows", app_state.use_shadows);
+
+    //variable rate shading mode selection
+    {
+        auto& rates = app_state.gl_state.shading_rates;
+
+        labeled_string(ui_draw_position, ui_state, output, "Shading Rate:", shading_rate_mode_name(rates.mode));
+
+        auto rate_left = false, rate_right = false;
+        left_right_selector(ui_draw_position, ui_state, output, "Shading Rate", rate_left, rate_right);
+
+        if (rate_left || rate_right)
+        {
+            const auto new_idx = alter_idx_wrapped(static_cast<int>(rates.mode), rate_left ? -1 : 1, shading_rate_mode_count);
+
+            rates.mode = static_cast<shading_rate_mode>(new_idx);
+        }
+    }
+
+    //dynamic resolution toggle and frame time target
+    if (app_state.resolution.enabled)
+    {
+        float_selector(ui_draw_position, output, ui_state, app_state.resolution.target_frame_ms, 1.0f);
+        increment_col(ui_draw_position, ui_state);
+        blit_string(ui_draw_position, "Target MS", ui_state, output, ui_state.text_col);
+        increment_row(ui_draw_position, ui_state);
+
+        if (app_state.resolution.target_frame_ms < 1.0f) app_state.resolution.target_frame_ms = 1.0f;
+    }
+
+    labeled_toggle(ui_draw_position, ui_state, output, "Dynamic Res", app_state.resolution.enabled);
+
+    //texture memory budget, shrinking it evicts inactive models straight away
+    {
+        int_selector(ui_draw_position, output, ui_state, model_textures.budget_mb, 1);
+        increment_col(ui_draw_position, ui_state);
+        blit_string(ui_draw_position, "Texture MB", ui_state, output, ui_state.text_col);
+        increment_row(ui_draw_position, ui_state);
+
+        if (model_textures.budget_mb < 1) model_textures.budget_mb = 1;
+
+        enforce_texture_budget(model_textures, models, model_count, app_state.active_model_idx);
+    }
+
     //model selection
     {
         auto model_left = false, model_right = false;
@@ -382,6 +571,7 @@ static void draw_ui(application_state& app_state)
 
             app_state.active_model_idx = new_idx;
 
+            make_model_resident(model_textures, workers, models, model_count, app_state.active_model_idx);
             app_state.active_model = &models[app_state.active_model_idx];
             app_state.ui_state.text_col = app_state.active_model->text_col;
 
@@ -409,6 +599,9 @@ static void draw_ui(application_state& app_state)
         }
     }
 
+    //active shader settings
+    app_state.active_shader->render_ui(ui_draw_position, ui_state, output);
+
     //draw shader and effect ui at the bottom left of the screen
     ui_state.row_start_x = output.frame_buffer.width - 270;
     ui_draw_position = v2_i{ ui_state.row_start_x, ui_state.screen_margin.y };
@@ -416,29 +609,81 @@ static void draw_ui(application_state& app_state)
     //render the effects ui if effects are active
     if(app_state.use_fx)
     {
-        //effect selection
+        auto& chain = app_state.effects;
+
+        //effect selection, for the selected slot of the chain
         {
             auto effect_left = false, effect_right = false;
             left_right_selector(ui_draw_position, ui_state, output, "Effect", effect_left, effect_right);
 
             if (effect_left || effect_right)
             {
-                const auto new_idx = alter_idx_wrapped(app_state.active_effect_idx, effect_left ? -1 : 1, screen_space_effect_count);
+                const auto current_idx = effect_index(chain.effects[app_state.selected_effect]);
+                const auto new_idx = alter_idx_wrapped(current_idx, effect_left ? -1 : 1, screen_space_effect_count);
+
+                chain.effects[app_state.selected_effect] = screen_space_effects[new_idx];
+            }
+        }
+
+        //slot selection
+        {
+            auto slot_left = false, slot_right = false;
+            left_right_selector(ui_draw_position, ui_state, output, "Slot", slot_left, slot_right);
+
+            if (slot_left || slot_right)
+            {
+                app_state.selected_effect = alter_idx_wrapped(app_state.selected_effect, slot_left ? -1 : 1, chain.count);
+            }
+        }
 
-                app_state.active_effect_idx = new_idx;
+        if (chain.count < max_effect_chain_length && labeled_button(ui_draw_position, ui_state, output, "Add Effect"))
+        {
+            chain.effects[chain.count] = screen_space_effects[0];
+            app_state.selected_effect = chain.count++;
+        }
 
-                app_state.active_effect = screen_space_effects[app_state.active_effect_idx];
+        if (chain.count > 1 && labeled_button(ui_draw_position, ui_state, output, "Remove Effect"))
+        {
+            for (auto i = app_state.selected_effect; i < chain.count - 1; i++)
+            {
+                chain.effects[i] = chain.effects[i + 1];
             }
+
+            chain.count--;
+            if (app_state.selected_effect >= chain.count) app_state.selected_effect = chain.count - 1;
         }
 
-        labeled_string(ui_draw_position, ui_state, output, "Effect:", app_state.active_effect->name());
+        auto& selected = *chain.effects[app_state.selected_effect];
+
+        char slot_buf[64];
+        FORMAT_PRINT(slot_buf, "%d", 64, app_state.selected_effect + 1);
+        labeled_string(ui_draw_position, ui_state, output, "Slot:", slot_buf);
+        labeled_string(ui_draw_position, ui_state, output, "Effect:", selected.name());
 
         if (labeled_button(ui_draw_position, ui_state, output, "Reset Effect"))
         {
-            app_state.active_effect->reset_settings();
+            selected.reset_settings();
         }
 
-        app_state.active_effect->render_ui(ui_draw_position, ui_state, output);
+        selected.render_ui(ui_draw_position, ui_state, output);
+
+        //the chain in the order it runs, top down. Effects fused into the pass before them share its cost
+        ui_draw_position.y += 5;
+        for (auto i = chain.count - 1; i >= 0; i--)
+        {
+            char pass_buf[64];
+
+            if (i > 0 && chain.pass_of[i] == chain.pass_of[i - 1])
+            {
+                FORMAT_PRINT(pass_buf, "%s", 64, "fused");
+            }
+            else
+            {
+                FORMAT_PRINT(pass_buf, "%.2fms", 64, chain.pass_ms[chain.pass_of[i]]);
+            }
+
+            labeled_string(ui_draw_position, ui_state, output, chain.effects[i]->name(), pass_buf);
+        }
     }
 
     //switch to drawing just below top of screen
@@ -457,6 +702,26 @@ static void draw_ui(application_state& app_state)
     FORMAT_PRINT(buf, "%d", 1024, app_state.active_model->get_face_count());
     labeled_string(ui_draw_position, ui_state, output, "Triangles:", buf);
 
+    //draw render scale
+    if (app_state.resolution.enabled)
+    {
+        FORMAT_PRINT(buf, "%.0f%%", 1024, app_state.resolution.scale * 100.0f);
+        labeled_string(ui_draw_position, ui_state, output, "Render Scale:", buf);
+    }
+
+    //draw resident texture memory
+    FORMAT_PRINT(buf, "%.1f MB", 1024, static_cast<float>(model_textures.resident_bytes) / (1024.0f * 1024.0f));
+    labeled_string(ui_draw_position, ui_state, output, "Textures:", buf);
+
+    FORMAT_PRINT(buf, "%d", 1024, model_textures.resident_models);
+    labeled_string(ui_draw_position, ui_state, output, "Resident Models:", buf);
+
+    //draw shadow map cache state
+    if (app_state.use_shadows)
+    {
+        labeled_string(ui_draw_position, ui_state, output, "Shadow Map:", scene_shadow_map.rebuilt_last_update ? "Rebuilt" : "Cached");
+    }
+
     //draw shader/model information
     ui_draw_position.y -= 5;
     labeled_string(ui_draw_position, ui_state, output, "Shader:", app_state.active_shader->name());
@@ -540,6 +805,87 @@ static void update_application_colors(application_state& app_state)
 #endif
 }
 
+/*
+    Moves the dynamic lights along orbits around the model. Lights are placed
+    in view space, every fourth light is a spot light aimed at the model.
+*/
+static void update_scene_lights(application_state& app_state)
+{
+    auto& gl_state = app_state.gl_state;
+
+    if (!app_state.use_point_lights)
+    {
+        gl_state.lights = nullptr;
+        gl_state.light_count = 0;
+        return;
+    }
+
+    const auto time = gl_state.culm_dt / 1000.0f;
+    const auto golden_ratio = 0.618034f;
+
+    for (auto i = 0; i < app_state.point_light_count; i++)
+    {
+        auto& light = scene_lights[i];
+
+        //spread lights out using the golden ratio, so any light count looks even
+        const auto spread = fmodf(static_cast<float>(i) * golden_ratio, 1.0f);
+        const auto angle = spread * 2.0f * static_cast<float>(M_PI) + time * (0.3f + spread * 0.5f);
+        const auto orbit_radius = 0.5f + 0.5f * spread;
+
+        light.position = v3{
+            cosf(angle) * orbit_radius,
+            sinf(static_cast<float>(i) * 1.7f + time * 0.5f) * 0.8f,
+            sinf(angle) * orbit_radius
+        };
+
+        const auto col = hsl_to_rgb(hsla{ spread, 0.9f, 0.5f, 1.0f });
+        light.color = v3{ col.r / 255.0f, col.g / 255.0f, col.b / 255.0f };
+        light.radius = 0.4f;
+
+        if (i % 4 == 0)
+        {
+            light.type = light_type::spot;
+            light.direction = (light.position * -1.0f).normalise();
+            light.radius = 1.0f;
+            light.cos_inner_cone = cosf(20.0f * static_cast<float>(M_PI) / 180.0f);
+            light.cos_outer_cone = cosf(30.0f * static_cast<float>(M_PI) / 180.0f);
+        }
+        else
+        {
+            light.type = light_type::point;
+        }
+    }
+
+    gl_state.lights = scene_lights;
+    gl_state.light_count = app_state.point_light_count;
+}
+
+//model is drawn into the middle 80% of the render target
+static m4 render_view_port(const int width, const int height)
+{
+    return view_port(
+        static_cast<float>(width) / 10,
+        static_cast<float>(height) / 10,
+        static_cast<float>(width) * 4 / 5,
+        static_cast<float>(height) * 4 / 5
+    );
+}
+
+/*
+    Shrinks the render target to the current dynamic resolution scale. Raster, light
+    tiles, shading rates and effects all work off the frame buffer dimensions, the
+    image is scaled back up to the full size before the ui is drawn.
+*/
+static void update_render_size(application_state& app_state)
+{
+    auto& output = app_state.gl_state.output_buffers;
+
+    const auto size = scaled_render_size(app_state.resolution, output.full_width, output.full_height);
+
+    set_render_size(output, size.x, size.y);
+    app_state.gl_state.viewport = render_view_port(size.x, size.y);
+}
+
 struct bit_scan_result
 {
     bool found;
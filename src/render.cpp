@@ -1,6 +1,26 @@
+#include <chrono>
+#include <vector>
+
 #include "render.h"
 #include "file.h"
 
+inline bool coverage_mask::tile_covered(const int tile_x, const int tile_y) const
+{
+    return (tiles[tile_y * words_per_row + tile_x / 32] >> (tile_x % 32)) & 1u;
+}
+
+static void reset_coverage(coverage_mask& coverage)
+{
+    //empty bounds, any marked span extends them
+    coverage.x_min = coverage.tiles_x * coverage_tile_size;
+    coverage.y_min = coverage.tiles_y * coverage_tile_size;
+    coverage.x_max = 0;
+    coverage.y_max = 0;
+    coverage.effect_reach = 0;
+
+    memset(coverage.tiles, 0, coverage.words_per_row * coverage.tiles_y * sizeof(unsigned int));
+}
+
 void init_output_buffers(output_buffers & output_buffers, const int width, const int height)
 {
     auto& frame_buffer = output_buffers.frame_buffer;
@@ -27,6 +47,9 @@ void init_output_buffers(output_buffers & output_buffers, const int width, const
     assert(temp_buffer.data != nullptr);
     memset(temp_buffer.data, 0, size);
 
+    output_buffers.full_width = width;
+    output_buffers.full_height = height;
+
     //alloc and init z buffer
     const auto z_buffer_size = width * height;
     z_buffer = new float[z_buffer_size];
@@ -35,6 +58,15 @@ void init_output_buffers(output_buffers & output_buffers, const int width, const
     {
         z_buffer[i] = min_z_buffer_val;
     }
+
+    //alloc and init coverage mask, one bit per tile
+    auto& coverage = output_buffers.coverage;
+    coverage.tiles_x = (width + coverage_tile_size - 1) / coverage_tile_size;
+    coverage.tiles_y = (height + coverage_tile_size - 1) / coverage_tile_size;
+    coverage.words_per_row = (coverage.tiles_x + 31) / 32;
+    coverage.tiles = new unsigned int[coverage.words_per_row * coverage.tiles_y];
+    assert(coverage.tiles != nullptr);
+    reset_coverage(coverage);
 }
 
 void clear_output_buffers(output_buffers& output_buffers, const rgba& clear_color)
@@ -52,6 +84,76 @@ void clear_output_buffers(output_buffers& output_buffers, const rgba& clear_colo
     {
         *walk++ = clear_color;
     }
+
+    reset_coverage(output_buffers.coverage);
+}
+
+void swap_color_buffers(output_buffers& output_buffers)
+{
+    //both allocations are full size, so only the pixels change hands. frame_buffer
+    //keeps the current render size
+    std::swap(output_buffers.frame_buffer.data, output_buffers.temp_buffer.data);
+}
+
+void set_render_size(output_buffers& output_buffers, const int width, const int height)
+{
+    assert(width > 0 && width <= output_buffers.full_width);
+    assert(height > 0 && height <= output_buffers.full_height);
+
+    output_buffers.frame_buffer.width = width;
+    output_buffers.frame_buffer.height = height;
+}
+
+/*
+ * Nearest neighbour upscale of the render back to the full buffer size, done in place.
+ *
+ * The reduced render is packed at the start of the frame buffer, and every source
+ * pixel sits at or before the destination pixel it maps to. So walking the destination
+ * backwards never overwrites a source pixel that is still needed. Rows that map to
+ * the same source row as the row below them are copied from it directly.
+ */
+void upscale_to_full_size(output_buffers& output_buffers)
+{
+    auto& frame_buffer = output_buffers.frame_buffer;
+
+    const auto src_width = frame_buffer.width;
+    const auto src_height = frame_buffer.height;
+    const auto dst_width = output_buffers.full_width;
+    const auto dst_height = output_buffers.full_height;
+
+    if (src_width == dst_width && src_height == dst_height) return;
+
+    auto* pixels = reinterpret_cast<rgba*>(frame_buffer.data);
+
+    //16.16 fixed point source steps per destination pixel
+    const auto x_step = (src_width << 16) / dst_width;
+    const auto y_step = (src_height << 16) / dst_height;
+
+    auto previous_src_y = -1;
+
+    for (auto y = dst_height - 1; y >= 0; y--)
+    {
+        const auto src_y = (y * y_step) >> 16;
+        auto* dst_row = pixels + y * dst_width;
+
+        if (src_y == previous_src_y)
+        {
+            memcpy(dst_row, dst_row + dst_width, dst_width * sizeof(rgba));
+            continue;
+        }
+
+        const auto* src_row = pixels + src_y * src_width;
+
+        for (auto x = dst_width - 1; x >= 0; x--)
+        {
+            dst_row[x] = src_row[(x * x_step) >> 16];
+        }
+
+        previous_src_y = src_y;
+    }
+
+    frame_buffer.width = dst_width;
+    frame_buffer.height = dst_height;
 }
 
 /*
@@ -62,6 +164,8 @@ void clear_output_buffers(output_buffers& output_buffers, const rgba& clear_colo
  *      https://en.wikipedia.org/wiki/Bresenham%27s_line_algorithm
  */
 void draw_line(v2_i v0, v2_i v1, image & out, rgba col){
+    const auto view = make_image_view(out);
+
     const auto distance_x = abs(v1.x - v0.x);
     const auto stride_x = v0.x < v1.x ? 1 : -1;
     const auto distance_y = -abs(v1.y - v0.y);
@@ -75,7 +179,7 @@ void draw_line(v2_i v0, v2_i v1, image & out, rgba col){
             v0.x >= 0 && v0.x < out.width - 1 &&
             v0.y >= 0 && v0.y < out.height - 1
         ){
-            set_pixel(out, col, v0.x, v0.y);
+            view.row(v0.y)[v0.x] = col;
         }
         
         if(v0.x == v1.x && v0.y == v1.y) break;
@@ -125,6 +229,115 @@ inline int clamp(int val, const int min, const int max){
     return val;
 }
 
+/*
+ *  Records that pixels [x_begin, x_end) of a top down row passed the depth test. Buffers
+ *  without a mask, such as the shadow map's, are not tracked.
+ */
+inline void mark_coverage(coverage_mask& coverage, const int row, const int x_begin, const int x_end)
+{
+    if (coverage.tiles == nullptr || x_begin >= x_end) return;
+
+    coverage.x_min = std::min(coverage.x_min, x_begin);
+    coverage.x_max = std::max(coverage.x_max, x_end);
+    coverage.y_min = std::min(coverage.y_min, row);
+    coverage.y_max = std::max(coverage.y_max, row + 1);
+
+    auto* words = coverage.tiles + (row / coverage_tile_size) * coverage.words_per_row;
+    for (auto tile_x = x_begin / coverage_tile_size; tile_x <= (x_end - 1) / coverage_tile_size; tile_x++)
+    {
+        words[tile_x / 32] |= 1u << (tile_x % 32);
+    }
+}
+
+/*
+ *  Coverage and depth test for a single pixel. If the pixel is inside the triangle and
+ *  passes the depth test, the z buffer is updated and the screen space barycentric
+ *  coordinates are returned in bc.
+ */
+inline bool test_pixel(
+    const int x, const int y,
+    const v2_i& t0, const v2_i& t1, const v2_i& t2,
+    const v4& vtx0, const v4& vtx1, const v4& vtx2,
+    render_state& state, v3& bc
+){
+    const auto& frame_buffer = state.output_buffers.frame_buffer;
+
+    bc = barycentric(t0, t1, t2, v2_i{x, y});
+
+    //skip points outside the triangle
+    if (bc.x < 0 || bc.y < 0 || bc.z < 0){
+        return false;
+    }
+
+    //interpolate z using barycentric coordinates
+    const auto z = static_cast<float>(vtx0.z) * bc.x +
+                   static_cast<float>(vtx1.z) * bc.y +
+                   static_cast<float>(vtx2.z) * bc.z;
+
+    //get current z buffer value, rows are stored top down like the frame buffer
+    auto* z_point = &state.output_buffers.z_buffer[
+        static_cast<int>(x + (frame_buffer.height - 1 - y) * frame_buffer.width)
+    ];
+
+    //only render the pixel if we are closer to the camera then the current z buffer value.
+    //after a depth pre-pass the z buffer holds the closest depth, so shade on equality.
+    if(*z_point < z || (state.depth_pre_pass && *z_point == z)){
+        *z_point = z;
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ *  Interpolates vertex attributes at a pixel and runs the fragment shader on it.
+ *  Returns false if the shader discarded the fragment.
+ */
+inline bool shade_pixel(
+    const int x, const int y, const v3& bc, const v3& bc_dx, const v3& bc_dy,
+    const v4& vtx0, const v4& vtx1, const v4& vtx2,
+    const v2& uv0, const v2& uv1, const v2& uv2,
+    const v3& n0, const v3& n1, const v3& n2,
+    const v3& tri_normal,
+    render_state & state,
+    shader & shader,
+    rgba & col
+){
+    //pass clip space barycentric coordinates to get perspective correct texture mapping 
+    auto clip_space_bc = v3{ bc.x / vtx0.w, bc.y / vtx1.w, bc.z / vtx2.w, };
+    clip_space_bc = clip_space_bc / (clip_space_bc.x + clip_space_bc.y + clip_space_bc.z);
+
+    //interpolate uv using barycentric coordinates
+    auto interpolated_uv = uv0 * clip_space_bc.x + uv1 * clip_space_bc.y + uv2 * clip_space_bc.z;
+
+    /*
+     *  uv derivatives from the triangle's screen space gradients. uv/w and 1/w are linear
+     *  in screen space, so differentiating uv = (uv/w) / (1/w) with the quotient rule gives
+     *  the exact perspective correct derivatives at this pixel.
+     */
+    const auto inv_w = bc.x / vtx0.w + bc.y / vtx1.w + bc.z / vtx2.w;
+    const auto inv_w_dx = bc_dx.x / vtx0.w + bc_dx.y / vtx1.w + bc_dx.z / vtx2.w;
+    const auto inv_w_dy = bc_dy.x / vtx0.w + bc_dy.y / vtx1.w + bc_dy.z / vtx2.w;
+
+    const auto uv_w_dx = uv0 * (bc_dx.x / vtx0.w) + uv1 * (bc_dx.y / vtx1.w) + uv2 * (bc_dx.z / vtx2.w);
+    const auto uv_w_dy = uv0 * (bc_dy.x / vtx0.w) + uv1 * (bc_dy.y / vtx1.w) + uv2 * (bc_dy.z / vtx2.w);
+
+    shader.uv_dx = (uv_w_dx - interpolated_uv * inv_w_dx) / inv_w;
+    shader.uv_dy = (uv_w_dy - interpolated_uv * inv_w_dy) / inv_w;
+
+    //interpolate normal using barycentric coordinates
+    v3 interpolated_normal{};
+    if(state.smooth_shading){
+        interpolated_normal = (n0 * clip_space_bc.x + n1 * clip_space_bc.y + n2 * clip_space_bc.z).normalise();
+    }
+    else{
+        interpolated_normal = tri_normal;
+    }
+
+    //apply fragment shader to get pixel color
+    return shader.fragment(clip_space_bc, col, interpolated_normal, interpolated_uv, v2_i{ x, y });
+}
+
 /*
  *  This function rasterizes a triangle to the screen.
  *
@@ -136,6 +349,10 @@ inline int clamp(int val, const int min, const int max){
  *  barycentric coordinates. If the point is within the triangle we perform depth testing
  *  and call the fragment shader if necessary. Otherwise we continue the loop. 
  *
+ *  When variable rate shading is on, the fragment shader runs once for the first pixel
+ *  of each shading rate sub-block that passes the depth test, and the color is re-used
+ *  for the rest of the sub-block.
+ *
  *  My implementation is based on these sources:
  *      https://www.scratchapixel.com/lessons/3d-basic-rendering/rasterization-practical-implementation/rasterization-stage
  *      https://fgiesen.wordpress.com/2013/02/08/triangle-rasterization-in-practice/
@@ -150,8 +367,8 @@ void triangle(
     shader & shader
 ){
     auto& frame_buffer = state.output_buffers.frame_buffer;
-    auto& z_buffer = state.output_buffers.z_buffer;
-    
+    const auto frame_view = make_image_view(frame_buffer);
+
     //map coordinates to the screen
     auto vtx0_screen = state.viewport * vtx0;
     auto vtx1_screen = state.viewport * vtx1;
@@ -172,66 +389,111 @@ void triangle(
     auto max_y = clamp(r_max(t0.y, t1.y, t2.y), 0, frame_buffer.height - 1);
     assert(min_y <= max_y);
 
-    //iterate over the triangle 
-    for(auto y = min_y; y <= max_y; y++){
+    //screen space barycentric gradients, constant across the triangle
+    const auto bc_origin = barycentric(t0, t1, t2, t0);
+    const auto bc_dx = barycentric(t0, t1, t2, v2_i{ t0.x + 1, t0.y }) - bc_origin;
+    const auto bc_dy = barycentric(t0, t1, t2, v2_i{ t0.x, t0.y + 1 }) - bc_origin;
+
+    const auto variable_rate =
+        state.shading_rates.mode != shading_rate_mode::off &&
+        state.shading_rates.rates != nullptr &&
+        !state.depth_only;
+
+    if (!variable_rate)
+    {
+        //iterate over the triangle 
+        for(auto y = min_y; y <= max_y; y++){
+            auto* frame_row = frame_view.row(y);
+            auto covered_min = max_x + 1;
+            auto covered_max = min_x;
+
+            for(auto x = min_x; x <= max_x; x++){
+                v3 bc;
+                if (!test_pixel(x, y, t0, t1, t2, vtx0, vtx1, vtx2, state, bc)){
+                    continue;
+                }
+
+                covered_min = std::min(covered_min, x);
+                covered_max = x + 1;
+
+                if (state.depth_only){
+                    continue;
+                }
+
+                rgba col{};
+                if(shade_pixel(x, y, bc, bc_dx, bc_dy, vtx0, vtx1, vtx2, uv0, uv1, uv2, n0, n1, n2, tri_normal, state, shader, col)){
+                    frame_row[x] = col;
+                }
+            }
+
+            mark_coverage(state.output_buffers.coverage, frame_buffer.height - 1 - y, covered_min, covered_max);
+        }
+    }
+    else
+    {
+        /*
+         *  Walk the triangle row by row as usual, but remember the shaded color of each
+         *  sub-block in a per column cache. A cache entry is valid while its stamp matches
+         *  the first row of the sub-block being drawn. Row indices (y / block height) would
+         *  repeat between shading rate tiles of different block heights, the first rows don't.
+         */
+        auto& rates = state.shading_rates;
+        auto* cache = rates.block_cache;
+
         for(auto x = min_x; x <= max_x; x++){
-            auto bc = barycentric(t0, t1, t2, v2_i{x, y});
-            
-            //draw point if inside triangle
-            if (bc.x >= 0 && bc.y >= 0 && bc.z >= 0){
-                //interpolate z using barycentric coordinates
-                auto z = static_cast<float>(vtx0.z) * bc.x +
-                              static_cast<float>(vtx1.z) * bc.y +
-                              static_cast<float>(vtx2.z) * bc.z;
-
-                //get current z buffer value
-                auto* z_point = &z_buffer[
-                    static_cast<int>(x + (frame_buffer.height - y) * frame_buffer.width)
-                ];
-                
-                //only render the pixel if we are closer to the camera then the current z buffer value
-                if(*z_point < z){
-                    *z_point = z;
-
-                    //pass clip space barycentric coordinates to get perspective correct texture mapping 
-                    auto clip_space_bc = v3{ bc.x / vtx0.w, bc.y / vtx1.w, bc.z / vtx2.w, };
-                    clip_space_bc = clip_space_bc / (clip_space_bc.x + clip_space_bc.y + clip_space_bc.z);
-
-                    //interpolate uv using barycentric coordinates
-                    auto interpolated_uv = uv0 * clip_space_bc.x + uv1 * clip_space_bc.y + uv2 * clip_space_bc.z;
-
-                    //interpolate normal using barycentric coordinates
-                    v3 interpolated_normal{};
-                    if(state.smooth_shading){
-                        interpolated_normal = (n0 * clip_space_bc.x + n1 * clip_space_bc.y + n2 * clip_space_bc.z).normalise();
-                    }
-                    else{
-                        interpolated_normal = tri_normal;
-                    }
-
-                    //apply fragment shader to get pixel color
-                    rgba col{};
-                    if(shader.fragment(clip_space_bc, col, interpolated_normal, interpolated_uv, v2_i{ x, y })){
-                        set_pixel(frame_buffer, col, x, y);
-                    }
+            cache[x].stamp = -1;
+        }
+
+        for(auto y = min_y; y <= max_y; y++){
+            const auto* tile_rates = rates.rates + (y / shading_rate_tile_size) * rates.tiles_x;
+            auto* frame_row = frame_view.row(y);
+            auto covered_min = max_x + 1;
+            auto covered_max = min_x;
+
+            for(auto x = min_x; x <= max_x; x++){
+                v3 bc;
+                if (!test_pixel(x, y, t0, t1, t2, vtx0, vtx1, vtx2, state, bc)){
+                    continue;
+                }
+
+                covered_min = std::min(covered_min, x);
+                covered_max = x + 1;
+
+                const auto block_size = shading_rate_block_size(tile_rates[x / shading_rate_tile_size]);
+                const auto stamp = y - y % block_size.y;
+
+                //sub-blocks are aligned to their size, the first column holds the cached color
+                auto& entry = cache[x - x % block_size.x];
+
+                //shade the first visible pixel of the sub-block, then broadcast its color.
+                //the shaded color covers the whole sub-block, so widen the uv footprint to match
+                if (entry.stamp != stamp){
+                    const auto block_bc_dx = bc_dx * static_cast<float>(block_size.x);
+                    const auto block_bc_dy = bc_dy * static_cast<float>(block_size.y);
+
+                    entry.visible = shade_pixel(x, y, bc, block_bc_dx, block_bc_dy, vtx0, vtx1, vtx2, uv0, uv1, uv2, n0, n1, n2, tri_normal, state, shader, entry.col);
+                    entry.stamp = stamp;
+                }
+
+                if (entry.visible){
+                    frame_row[x] = entry.col;
                 }
             }
+
+            mark_coverage(state.output_buffers.coverage, frame_buffer.height - 1 - y, covered_min, covered_max);
         }
     }
 
     //draw triangle wireframe if wireframe is on
-    if (state.wire_frame) {
+    if (state.wire_frame && !state.depth_only) {
         draw_line(t0, t1, frame_buffer, blue);
         draw_line(t1, t2, frame_buffer, blue);
         draw_line(t2, t0, frame_buffer, blue);
     }
 }
 
-void draw_model(model & obj, render_state & state, shader & shader)
+static void draw_model_pass(model & obj, render_state & state, shader & shader)
 {
-    shader.model_to_draw = &obj;
-    shader.renderer_state = &state;
-
     /*
     *   Viewer position in object space, used for fast backface culling. This
     *   might break some shader setups, as I pre-suppose the matrix transform
@@ -286,33 +548,318 @@ void draw_model(model & obj, render_state & state, shader & shader)
     }
 }
 
+void draw_model(model & obj, render_state & state, shader & shader)
+{
+    shader.model_to_draw = &obj;
+    shader.renderer_state = &state;
+
+    /*
+    *   Lit shaders need to know which lights touch each screen tile before shading,
+    *   and the tile depth ranges used for culling come from the z buffer. So when
+    *   there are dynamic lights we rasterize depth first, cull the lights, and then
+    *   shade only the closest fragment of each pixel.
+    */
+    const auto use_light_tiles = shader.uses_lights() && state.light_count > 0;
+
+    if (use_light_tiles)
+    {
+        state.depth_only = true;
+        draw_model_pass(obj, state, shader);
+        state.depth_only = false;
+
+        build_light_tiles(state);
+    }
+
+    state.depth_pre_pass = use_light_tiles;
+    draw_model_pass(obj, state, shader);
+    state.depth_pre_pass = false;
+}
+
+inline const float* effect_tile::depth_row(const int y) const
+{
+    return depth + y * depth_pitch;
+}
+
+void screen_space_effect::apply_tile(const effect_tile& tile)
+{
+    for (auto y = tile.y_min; y < tile.y_max; y++) {
+        const auto* in = tile.input.row(y);
+        auto* out = tile.output.row(y);
+
+        for (auto x = tile.x_min; x < tile.x_max; x++) {
+            out[x] = apply(&renderer_state->output_buffers.frame_buffer, x, y, in[x]);
+        }
+    }
+}
+
+rgba screen_space_effect::apply(image* frame_buffer, int x, int y, const rgba& pixel)
+{
+    return pixel;
+}
 
-void apply_screen_space_effect(screen_space_effect& effect, render_state& state)
+int screen_space_effect::footprint_rows()
 {
-    effect.temp_buffer = &state.output_buffers.temp_buffer;
-    effect.renderer_state = &state;
+    //the per pixel adapter hands effects the whole frame buffer, so assume they read any of it
+    return -1;
+}
 
-    const auto width = state.output_buffers.frame_buffer.width;
-    const auto height = state.output_buffers.frame_buffer.height;
+int screen_space_effect::coverage_margin()
+{
+    return -1;
+}
 
-    auto* const img_data = reinterpret_cast<rgba*>(state.output_buffers.frame_buffer.data);
+void screen_space_effect::begin_pass(const image_view& input)
+{
+}
 
-    //run the effect on a temporary buffer
-    for (auto y = 0; y < height; y++) {
-        for (auto x = 0; x < width; x++) {
-            const auto idx = y * width + x;
+/*
+ * Effects run over bands of whole rows, one job per band. Bands are small enough
+ * that a band's input rows, plus the rows either side that filters read, stay in
+ * cache, and there are enough of them to keep every worker busy.
+ */
+static const int effect_band_rows = 16;
+static const int fused_band_rows = 64;
+
+//fused effects recompute this many extra rows per band at most, past it they get another pass
+static const int max_fused_halo_rows = 8;
+
+//band sized intermediate images for fused passes, one pair per thread
+static thread_local std::vector<rgba> effect_scratch[2];
+
+//columns [x_min, x_max) of a band that a pass runs over
+struct column_span
+{
+    int x_min;
+    int x_max;
+};
+
+static thread_local std::vector<column_span> effect_spans;
+
+/*
+ * Finds the columns of rows [y_min, y_max) that lie within margin pixels of a covered
+ * tile. Spans closer together than gap columns are merged, so they stay apart once the
+ * caller widens them by up to half the gap.
+ */
+static void covered_spans(
+    const coverage_mask& coverage, const int y_min, const int y_max, const int width,
+    const int margin, const int gap, std::vector<column_span>& spans
+){
+    spans.clear();
+
+    const auto row_min = std::max(y_min - margin, coverage.y_min);
+    const auto row_max = std::min(y_max + margin, coverage.y_max);
+    if (coverage.x_min >= coverage.x_max || row_min >= row_max) return;
+
+    const auto tile_y_min = row_min / coverage_tile_size;
+    const auto tile_y_max = (row_max - 1) / coverage_tile_size;
+
+    for (auto tile_x = coverage.x_min / coverage_tile_size; tile_x <= (coverage.x_max - 1) / coverage_tile_size; tile_x++)
+    {
+        auto covered = false;
+        for (auto tile_y = tile_y_min; tile_y <= tile_y_max && !covered; tile_y++)
+        {
+            covered = coverage.tile_covered(tile_x, tile_y);
+        }
 
-            auto pixel = img_data[idx];
+        if (!covered) continue;
 
-            const auto new_pixel = effect.apply(&state.output_buffers.frame_buffer, x, y, pixel);
+        const auto x_min = std::max(tile_x * coverage_tile_size - margin, 0);
+        const auto x_max = std::min((tile_x + 1) * coverage_tile_size + margin, width);
 
-            reinterpret_cast<rgba*>(state.output_buffers.temp_buffer.data)[idx] = new_pixel;
+        if (!spans.empty() && x_min <= spans.back().x_max + gap)
+        {
+            spans.back().x_max = std::max(spans.back().x_max, x_max);
+        }
+        else
+        {
+            spans.push_back({ x_min, x_max });
         }
     }
+}
 
-    //copy effect output to the framebuffer
-    for (auto i = 0; i < width * height; i++)
+/*
+ * Runs effects[0..count) as a single pass over the frame. Within a band, each effect
+ * but the last writes to a scratch band, which the next effect reads. Effects later in
+ * the pass read rows around the band, so earlier ones cover the band plus the sum of
+ * the footprints of the effects after them. Bands only read the frame buffer, so they
+ * run in any order and the output matches running the effects one pass at a time.
+ *
+ * While every effect run on the frame so far, this pass included, leaves pixels away
+ * from the rasterized geometry alone, bands only run the effects over columns near
+ * covered tiles and copy the rest.
+ */
+static void apply_fused_effects(screen_space_effect** effects, const int count, render_state& state)
+{
+    auto& frame_buffer = state.output_buffers.frame_buffer;
+    const auto width = frame_buffer.width;
+    const auto height = frame_buffer.height;
+
+    //rows each effect must produce beyond the band, for the effects after it
+    int halo[max_effect_chain_length]{};
+    for (auto i = count - 2; i >= 0; i--)
+    {
+        halo[i] = halo[i + 1] + effects[i + 1]->footprint_rows();
+    }
+
+    //how far the frame can differ from the clear color past the coverage once the pass
+    //has run, on top of what earlier passes changed. -1 if it can differ anywhere
+    auto& coverage = state.output_buffers.coverage;
+    auto margin = coverage.effect_reach;
+    for (auto i = 0; i < count && margin >= 0; i++)
+    {
+        const auto effect_margin = effects[i]->coverage_margin();
+        margin = effect_margin < 0 ? -1 : margin + effect_margin;
+    }
+
+    coverage.effect_reach = margin;
+    const auto skip_uncovered = margin >= 0 && coverage.tiles != nullptr;
+
+    //the temp buffer is allocated at full size, view it at the render size
+    auto temp = frame_buffer;
+    temp.data = state.output_buffers.temp_buffer.data;
+
+    effect_tile frame{};
+    frame.x_min = 0;
+    frame.x_max = width;
+    frame.input = make_image_view(frame_buffer, image_origin::top_left);
+    frame.output = make_image_view(temp, image_origin::top_left);
+    frame.depth = state.output_buffers.z_buffer;
+    frame.depth_pitch = width;
+
+    //fused passes recompute their halo rows in every band, taller bands spread that cost
+    const auto band_rows = halo[0] > 0 ? fused_band_rows : effect_band_rows;
+    const auto band_count = (height + band_rows - 1) / band_rows;
+    const auto scratch_rows = band_rows + 2 * halo[0];
+
+    for (auto i = 0; i < count; i++)
     {
-        img_data[i] = reinterpret_cast<rgba*>(state.output_buffers.temp_buffer.data)[i];
+        effects[i]->begin_pass(frame.input);
     }
-}
\ No newline at end of file
+
+    const auto apply_band = [&](const int band) {
+        const auto band_min = band * band_rows;
+        const auto band_max = std::min(band_min + band_rows, height);
+
+        //scratch views are addressed by frame row, starting at the first row the band needs
+        const auto scratch_base = band_min - halo[0];
+        image_view scratch[2];
+
+        for (auto i = 0; i < 2 && count > 1; i++)
+        {
+            auto& rows = effect_scratch[i];
+            if (static_cast<int>(rows.size()) < width * scratch_rows) rows.resize(width * scratch_rows);
+
+            scratch[i] = frame.input;
+            scratch[i].first_row = reinterpret_cast<unsigned char*>(rows.data()) - scratch_base * scratch[i].pitch;
+        }
+
+        auto& spans = effect_spans;
+        if (skip_uncovered)
+        {
+            covered_spans(coverage, band_min, band_max, width, margin, 2 * halo[0], spans);
+        }
+        else
+        {
+            spans.assign(1, { 0, width });
+        }
+
+        for (auto i = 0; i < count; i++)
+        {
+            auto tile = frame;
+            tile.y_min = std::max(band_min - halo[i], 0);
+            tile.y_max = std::min(band_max + halo[i], height);
+
+            if (i > 0) tile.input = scratch[(i - 1) & 1];
+            if (i < count - 1) tile.output = scratch[i & 1];
+
+            //filters read as many columns either side as rows, so spans widen like the band
+            for (const auto& span : spans)
+            {
+                tile.x_min = std::max(span.x_min - halo[i], 0);
+                tile.x_max = std::min(span.x_max + halo[i], width);
+
+                effects[i]->apply_tile(tile);
+            }
+        }
+
+        //the effects would leave the remaining columns as they were
+        for (auto y = band_min; y < band_max && skip_uncovered; y++)
+        {
+            const auto* in = frame.input.row(y);
+            auto* out = frame.output.row(y);
+            auto x = 0;
+
+            for (const auto& span : spans)
+            {
+                memcpy(out + x, in + x, (span.x_min - x) * sizeof(rgba));
+                x = span.x_max;
+            }
+
+            memcpy(out + x, in + x, (width - x) * sizeof(rgba));
+        }
+    };
+
+    if (state.workers != nullptr)
+    {
+        parallel_for(*state.workers, band_count, apply_band);
+    }
+    else
+    {
+        for (auto band = 0; band < band_count; band++) apply_band(band);
+    }
+
+    //the effect output becomes the frame
+    swap_color_buffers(state.output_buffers);
+}
+
+void apply_screen_space_effect(screen_space_effect& effect, render_state& state)
+{
+    effect_chain chain{};
+    chain.effects[0] = &effect;
+    chain.count = 1;
+
+    apply_effect_chain(chain, state);
+}
+
+void apply_effect_chain(effect_chain& chain, render_state& state)
+{
+    chain.pass_count = 0;
+
+    for (auto i = 0; i < chain.count; i++)
+    {
+        chain.effects[i]->temp_buffer = &state.output_buffers.temp_buffer;
+        chain.effects[i]->renderer_state = &state;
+    }
+
+    auto first = 0;
+    while (first < chain.count)
+    {
+        //grow the pass while the rows recomputed per band stay few
+        auto last = first + 1;
+        auto halo = 0;
+
+        if (chain.effects[first]->footprint_rows() >= 0)
+        {
+            while (last < chain.count)
+            {
+                const auto footprint = chain.effects[last]->footprint_rows();
+                if (footprint < 0 || halo + footprint > max_fused_halo_rows) break;
+
+                halo += footprint;
+                last++;
+            }
+        }
+
+        const auto start = std::chrono::high_resolution_clock::now();
+        apply_fused_effects(chain.effects + first, last - first, state);
+        const auto end = std::chrono::high_resolution_clock::now();
+
+        for (auto i = first; i < last; i++)
+        {
+            chain.pass_of[i] = chain.pass_count;
+        }
+
+        chain.pass_ms[chain.pass_count++] = std::chrono::duration<float, std::milli>(end - start).count();
+        first = last;
+    }
+}
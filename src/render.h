@@ -3,14 +3,57 @@
 
 #include "maths.h"
 #include "image.h"
+#include "lighting.h"
+#include "shading_rate.h"
+#include "worker_pool.h"
 
 struct screen_space_effect;
+struct shadow_map;
 static const int min_z_buffer_val = -1000;
 
+static const int coverage_tile_size = 16;
+
+/*
+ * Where the rasterizer wrote depth this frame, as a bounding rectangle and a bit per
+ * coverage_tile_size square tile. Rows are numbered top down, like the z buffer. Screen
+ * space effects use it to leave the background alone.
+ */
+struct coverage_mask
+{
+    //exclusive maxima, nothing has been drawn while x_min >= x_max
+    int x_min{}, x_max{};
+    int y_min{}, y_max{};
+
+    //sized for the full size buffers, rows of tile bits are words_per_row apart
+    int tiles_x{};
+    int tiles_y{};
+    int words_per_row{};
+    unsigned int* tiles{};
+
+    //how far effects run since the clear may have changed pixels past the coverage, -1
+    //once one may have changed any of them
+    int effect_reach{};
+
+    inline bool tile_covered(int tile_x, int tile_y) const;
+};
+
+/*
+ * frame_buffer is the current color target, drawn to and presented. temp_buffer is a
+ * second color allocation of the same size, passes that read the whole frame (such as
+ * screen space effects) write into it, then swap_color_buffers makes it current.
+ */
 struct output_buffers{
     image frame_buffer;
     image temp_buffer;
     float * z_buffer{};
+
+    //reset when the buffers are cleared, filled in as triangles are drawn
+    coverage_mask coverage;
+
+    //allocated size of the buffers. frame_buffer and z_buffer may be set to a smaller
+    //render size, in which case they are packed at the start of the allocation.
+    int full_width{};
+    int full_height{};
 };
 
 /*
@@ -21,6 +64,13 @@ struct output_buffers{
 void init_output_buffers(output_buffers& output_buffers, int width, int height);
 void clear_output_buffers(output_buffers& output_buffers, const rgba& clear_color);
 
+//makes temp_buffer's pixels the current frame, and the old frame the new temp_buffer
+void swap_color_buffers(output_buffers& output_buffers);
+
+//dynamic resolution, render at a reduced size then scale back up to the full size
+void set_render_size(output_buffers& output_buffers, int width, int height);
+void upscale_to_full_size(output_buffers& output_buffers);
+
 struct render_state{
     v3 eye{};
     v3 center{};
@@ -31,14 +81,35 @@ struct render_state{
     m4 projection{};
     m4 viewport{};
 
+    //object to world transform, model_view without the camera
+    m4 model_matrix{};
+
     output_buffers output_buffers;
 
+    //dynamic lights, culled into screen tiles after a depth pre-pass
+    light* lights{};
+    int light_count{};
+    light_tile_grid light_tiles;
+
+    //directional shadows from light_dir, null when disabled
+    shadow_map* shadows{};
+
+    //per tile fragment shading rates
+    shading_rate_image shading_rates;
+
+    //threads for screen space effects, null runs them on the calling thread
+    worker_pool* workers{};
+
     bool backspace_culling = true;
     bool wire_frame = false;
     bool smooth_shading = true;
 
     float dt=0;
     float culm_dt=0;
+
+    //depth_only skips fragment shading, depth_pre_pass means the z buffer already holds final depths
+    bool depth_only = false;
+    bool depth_pre_pass = false;
 };
 
 
@@ -50,11 +121,17 @@ struct shader
     render_state * renderer_state{};
     mesh * mesh_to_draw{};
     model* model_to_draw{};
+
+    //screen space uv derivatives of the fragment being shaded, for mip level selection
+    v2 uv_dx{};
+    v2 uv_dy{};
     
     virtual const char* name() = 0;
+    virtual bool uses_lights() = 0;
     virtual void begin_pass() = 0;
     virtual v4 vertex(v3 & vertex, int face_no, int vert_no) = 0;
     virtual bool fragment(const v3& bar, rgba & col, v3 interpolated_normal, v2 interpolated_uv, const v2_i& screen_pos) = 0;
+    virtual void render_ui(v2_i& base_pos, ui_state& ui_state, output_buffers& output) = 0;
 
     shader() = default;
 
@@ -68,13 +145,54 @@ struct shader
         virtual ~shader() = default;
 };
 
+/*
+ * A rectangle of pixels for a screen space effect to process, x_max and y_max are
+ * exclusive. Rows are numbered top down, in storage order, for the input frame, the
+ * output frame and the depth buffer alike.
+ */
+struct effect_tile
+{
+    int x_min{}, x_max{};
+    int y_min{}, y_max{};
+
+    image_view input;
+    image_view output;
+
+    const float* depth{};
+    int depth_pitch{};
+
+    inline const float* depth_row(int y) const;
+};
+
 struct screen_space_effect
 {
     render_state* renderer_state{};
     image* temp_buffer{};
 
     virtual const char* name() = 0;
-    virtual rgba apply(image* frame_buffer, int x, int y, const rgba& pixel) = 0;
+
+    //reads input rows and writes every pixel of the tile to the output rows. Tiles of
+    //the same pass may run at the same time on different threads
+    virtual void apply_tile(const effect_tile& tile);
+
+    //optional per pixel form, the default apply_tile calls it for every pixel
+    virtual rgba apply(image* frame_buffer, int x, int y, const rgba& pixel);
+
+    //rows above and below a pixel, and columns either side of it, that its output reads
+    //from the input. -1 if the effect reads the frame some other way (such as through
+    //apply or begin_pass) and needs a pass of its own
+    virtual int footprint_rows();
+
+    //how far past the rasterized coverage the effect may change pixels while the rest of
+    //the frame is the clear color, -1 if it may change any of them. Margins add up over
+    //the effects run on a frame, pixels further out are copied rather than passed to
+    //apply_tile
+    virtual int coverage_margin();
+
+    //called once before the tiles of the pass that runs the effect, with the frame that
+    //pass reads, for effects that gather from the whole frame up front
+    virtual void begin_pass(const image_view& input);
+
     virtual void render_ui(v2_i& base_pos, ui_state& ui_state, output_buffers& output) = 0;
     virtual void reset_settings() = 0;
 
@@ -91,8 +209,28 @@ struct screen_space_effect
 
 };
 
+static const int max_effect_chain_length = 4;
+
+/*
+ * Effects applied one after another. Neighbouring effects with small footprints are
+ * fused into a single pass over the frame: each band runs every effect of the pass in
+ * turn through a scratch band, widened by the rows that the later effects read, so
+ * the frame is only read and written once per pass rather than once per effect.
+ */
+struct effect_chain
+{
+    screen_space_effect* effects[max_effect_chain_length]{};
+    int count{};
+
+    //filled in when the chain is applied, the pass each effect ran in and each pass's cost
+    int pass_of[max_effect_chain_length]{};
+    float pass_ms[max_effect_chain_length]{};
+    int pass_count{};
+};
+
 void draw_model(model & obj, render_state& state, shader& shader);
 void draw_line(v2_i v0, v2_i v1, image& out, rgba col);
 void apply_screen_space_effect(screen_space_effect& effect, render_state & state);
+void apply_effect_chain(effect_chain& chain, render_state& state);
 
 #endif
\ No newline at end of file
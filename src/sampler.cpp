@@ -0,0 +1,420 @@
+#include <cmath>
+#include <cstring>
+#include <cassert>
+
+#include "sampler.h"
+#include "simd.h"
+
+//blend weights are 7 bit, so (b - a) * weight fits in a signed 16 bit lane
+static const int sampler_weight_bits = 7;
+static const int sampler_weight_one = 1 << sampler_weight_bits;
+
+const char* texture_filter_name(const texture_filter filter)
+{
+    switch (filter)
+    {
+    case texture_filter::nearest: return "Nearest";
+    case texture_filter::bilinear: return "Bilinear";
+    case texture_filter::trilinear: return "Trilinear";
+    }
+
+    return "";
+}
+
+const char* texture_address_name(const texture_address address)
+{
+    switch (address)
+    {
+    case texture_address::wrap: return "Wrap";
+    case texture_address::clamp: return "Clamp";
+    case texture_address::mirror: return "Mirror";
+    }
+
+    return "";
+}
+
+inline int address_texel(const int coord, const int size, const texture_address address)
+{
+    //power of two fast path
+    if ((size & (size - 1)) == 0)
+    {
+        const auto mask = size - 1;
+
+        switch (address)
+        {
+        case texture_address::wrap: return coord & mask;
+        case texture_address::mirror: return (coord & size) ? (~coord & mask) : (coord & mask);
+        case texture_address::clamp:
+        default: return coord < 0 ? 0 : (coord > mask ? mask : coord);
+        }
+    }
+
+    switch (address)
+    {
+    case texture_address::wrap: {
+        const auto wrapped = coord % size;
+        return wrapped < 0 ? wrapped + size : wrapped;
+    }
+    case texture_address::mirror: {
+        const auto period = size * 2;
+        auto wrapped = coord % period;
+        if (wrapped < 0) wrapped += period;
+        return wrapped < size ? wrapped : period - 1 - wrapped;
+    }
+    case texture_address::clamp:
+    default: return coord < 0 ? 0 : (coord > size - 1 ? size - 1 : coord);
+    }
+}
+
+inline rgba lerp_rgba(const rgba& a, const rgba& b, const int weight)
+{
+    rgba ret;
+    for (auto i = 0; i < 4; i++)
+    {
+        const auto diff = static_cast<int>(b.e[i]) - static_cast<int>(a.e[i]);
+        ret.e[i] = static_cast<unsigned char>(a.e[i] + ((diff * weight) >> sampler_weight_bits));
+    }
+    return ret;
+}
+
+/*
+ * Blends a 2x2 block of texels, c00 is the bottom left texel and c11 the top right.
+ * Vertical blends happen first, then the horizontal blend of the two results.
+ *
+ * The SSE2 path widens all four texels into two registers, (c00, c10) and (c01, c11),
+ * so both columns are blended vertically by one multiply. The scalar path does the
+ * same integer math, so both give identical results.
+ */
+inline rgba bilinear_blend(const rgba& c00, const rgba& c10, const rgba& c01, const rgba& c11, const int weight_x, const int weight_y)
+{
+#if USE_SSE2
+    int packed[4];
+    memcpy(&packed[0], &c00, sizeof(int));
+    memcpy(&packed[1], &c10, sizeof(int));
+    memcpy(&packed[2], &c01, sizeof(int));
+    memcpy(&packed[3], &c11, sizeof(int));
+
+    const auto zero = _mm_setzero_si128();
+    const auto texels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(packed));
+
+    const auto bottom = _mm_unpacklo_epi8(texels, zero);
+    const auto top = _mm_unpackhi_epi8(texels, zero);
+
+    const auto columns = _mm_add_epi16(bottom, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(top, bottom), _mm_set1_epi16(static_cast<short>(weight_y))), sampler_weight_bits));
+    const auto right = _mm_srli_si128(columns, 8);
+
+    const auto blended = _mm_add_epi16(columns, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(right, columns), _mm_set1_epi16(static_cast<short>(weight_x))), sampler_weight_bits));
+
+    const auto result = _mm_cvtsi128_si32(_mm_packus_epi16(blended, zero));
+
+    rgba col;
+    memcpy(&col, &result, sizeof(col));
+    return col;
+#else
+    return lerp_rgba(lerp_rgba(c00, c01, weight_y), lerp_rgba(c10, c11, weight_y), weight_x);
+#endif
+}
+
+inline rgba sample_level_nearest(const sampler& sampler, const texture& tex, const int level, const v2& uv)
+{
+    const auto& img = tex.levels[level];
+
+    const auto x = address_texel(static_cast<int>(floorf(uv.x * static_cast<float>(img.width))), img.width, sampler.address);
+    const auto y = address_texel(static_cast<int>(floorf(uv.y * static_cast<float>(img.height))), img.height, sampler.address);
+
+    return get_texel(tex, level, x, y);
+}
+
+/*
+ * Same blend as bilinear_blend, for normal_xy8 texels. The four 2 byte texels fit in
+ * the low half of a single register, giving 8 channels in 16 bit lanes.
+ */
+inline unsigned int bilinear_blend_xy(const unsigned short c00, const unsigned short c10, const unsigned short c01, const unsigned short c11, const int weight_x, const int weight_y)
+{
+#if USE_SSE2
+    const auto zero = _mm_setzero_si128();
+    const auto texels = _mm_setr_epi16(
+        static_cast<short>(c00), static_cast<short>(c10), static_cast<short>(c01), static_cast<short>(c11),
+        0, 0, 0, 0
+    );
+
+    const auto bottom = _mm_unpacklo_epi8(texels, zero);
+    const auto top = _mm_srli_si128(bottom, 8);
+
+    const auto columns = _mm_add_epi16(bottom, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(top, bottom), _mm_set1_epi16(static_cast<short>(weight_y))), sampler_weight_bits));
+    const auto right = _mm_srli_si128(columns, 4);
+
+    const auto blended = _mm_add_epi16(columns, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(right, columns), _mm_set1_epi16(static_cast<short>(weight_x))), sampler_weight_bits));
+
+    return static_cast<unsigned int>(_mm_cvtsi128_si32(blended));
+#else
+    unsigned int ret = 0;
+    for (auto i = 0; i < 2; i++)
+    {
+        const auto shift = i * 8;
+        const auto b0 = (c00 >> shift) & 0xff, b1 = (c10 >> shift) & 0xff;
+        const auto t0 = (c01 >> shift) & 0xff, t1 = (c11 >> shift) & 0xff;
+
+        const auto left = b0 + (((t0 - b0) * weight_y) >> sampler_weight_bits);
+        const auto right = b1 + (((t1 - b1) * weight_y) >> sampler_weight_bits);
+
+        ret |= static_cast<unsigned int>(left + (((right - left) * weight_x) >> sampler_weight_bits)) << (i * 16);
+    }
+    return ret;
+#endif
+}
+
+//the 2x2 texels and weights for a bilinear sample
+struct bilinear_footprint
+{
+    int x0, x1;
+    int y0, y1;
+    int weight_x, weight_y;
+};
+
+inline bilinear_footprint get_bilinear_footprint(const sampler& sampler, const image& img, const v2& uv)
+{
+    //texel centers sit at half texel offsets, move to fixed point relative to them
+    const auto fixed_x = static_cast<int>(floorf((uv.x * static_cast<float>(img.width) - 0.5f) * sampler_weight_one));
+    const auto fixed_y = static_cast<int>(floorf((uv.y * static_cast<float>(img.height) - 0.5f) * sampler_weight_one));
+
+    const auto texel_x = fixed_x >> sampler_weight_bits;
+    const auto texel_y = fixed_y >> sampler_weight_bits;
+
+    return {
+        address_texel(texel_x, img.width, sampler.address),
+        address_texel(texel_x + 1, img.width, sampler.address),
+        address_texel(texel_y, img.height, sampler.address),
+        address_texel(texel_y + 1, img.height, sampler.address),
+        fixed_x & (sampler_weight_one - 1),
+        fixed_y & (sampler_weight_one - 1),
+    };
+}
+
+inline rgba sample_level_bilinear(const sampler& sampler, const texture& tex, const int level, const v2& uv)
+{
+    const auto f = get_bilinear_footprint(sampler, tex.levels[level], uv);
+
+    return bilinear_blend(
+        get_texel(tex, level, f.x0, f.y0), get_texel(tex, level, f.x1, f.y0),
+        get_texel(tex, level, f.x0, f.y1), get_texel(tex, level, f.x1, f.y1),
+        f.weight_x, f.weight_y
+    );
+}
+
+inline rgba sample_texture(const sampler& sampler, const texture& tex, const v2& uv, float lod)
+{
+    const auto max_level = tex.level_count - 1;
+
+    if (lod < 0) lod = 0;
+    if (lod > static_cast<float>(max_level)) lod = static_cast<float>(max_level);
+
+    switch (sampler.filter)
+    {
+    case texture_filter::nearest:
+        return sample_level_nearest(sampler, tex, static_cast<int>(lod + 0.5f), uv);
+
+    case texture_filter::trilinear: {
+        const auto level = static_cast<int>(lod);
+        const auto weight = static_cast<int>((lod - static_cast<float>(level)) * sampler_weight_one);
+
+        const auto fine = sample_level_bilinear(sampler, tex, level, uv);
+        if (weight == 0 || level == max_level) return fine;
+
+        const auto coarse = sample_level_bilinear(sampler, tex, level + 1, uv);
+        return lerp_rgba(fine, coarse, weight);
+    }
+
+    case texture_filter::bilinear:
+    default:
+        return sample_level_bilinear(sampler, tex, static_cast<int>(lod + 0.5f), uv);
+    }
+}
+
+//rebuild z from the unit length constraint, filtered x/y can be slightly short of it
+inline v3 decode_normal_xy(const int x_byte, const int y_byte)
+{
+    const auto x = static_cast<float>(x_byte) * (2.0f / 255.0f) - 1.0f;
+    const auto y = static_cast<float>(y_byte) * (2.0f / 255.0f) - 1.0f;
+    const auto z_sq = 1.0f - x * x - y * y;
+
+    return { x, y, z_sq > 0 ? sqrtf(z_sq) : 0.0f };
+}
+
+/*
+ * Filtered x/y channels of a normal_xy8 texture, x in the low 16 bits. Follows the
+ * same filter rules as sample_texture.
+ */
+inline unsigned int sample_normal_xy(const sampler& sampler, const texture& tex, const int level, const v2& uv, const bool bilinear)
+{
+    const auto& img = tex.levels[level];
+
+    if (!bilinear)
+    {
+        const auto x = address_texel(static_cast<int>(floorf(uv.x * static_cast<float>(img.width))), img.width, sampler.address);
+        const auto y = address_texel(static_cast<int>(floorf(uv.y * static_cast<float>(img.height))), img.height, sampler.address);
+
+        const auto packed = get_normal_texel(tex, level, x, y);
+        return (packed & 0xffu) | (static_cast<unsigned int>(packed >> 8) << 16);
+    }
+
+    const auto f = get_bilinear_footprint(sampler, img, uv);
+
+    return bilinear_blend_xy(
+        get_normal_texel(tex, level, f.x0, f.y0), get_normal_texel(tex, level, f.x1, f.y0),
+        get_normal_texel(tex, level, f.x0, f.y1), get_normal_texel(tex, level, f.x1, f.y1),
+        f.weight_x, f.weight_y
+    );
+}
+
+inline v3 sample_normal(const sampler& sampler, const texture& tex, const v2& uv, float lod)
+{
+    assert(tex.format == texture_format::normal_xy8);
+
+    const auto max_level = tex.level_count - 1;
+
+    if (lod < 0) lod = 0;
+    if (lod > static_cast<float>(max_level)) lod = static_cast<float>(max_level);
+
+    unsigned int xy;
+
+    switch (sampler.filter)
+    {
+    case texture_filter::nearest:
+        xy = sample_normal_xy(sampler, tex, static_cast<int>(lod + 0.5f), uv, false);
+        break;
+
+    case texture_filter::trilinear: {
+        const auto level = static_cast<int>(lod);
+        const auto weight = static_cast<int>((lod - static_cast<float>(level)) * sampler_weight_one);
+
+        xy = sample_normal_xy(sampler, tex, level, uv, true);
+
+        if (weight != 0 && level != max_level)
+        {
+            const auto coarse = sample_normal_xy(sampler, tex, level + 1, uv, true);
+
+            const auto x0 = static_cast<int>(xy & 0xffff), y0 = static_cast<int>(xy >> 16);
+            const auto x1 = static_cast<int>(coarse & 0xffff), y1 = static_cast<int>(coarse >> 16);
+
+            xy = static_cast<unsigned int>(x0 + (((x1 - x0) * weight) >> sampler_weight_bits)) |
+                 static_cast<unsigned int>(y0 + (((y1 - y0) * weight) >> sampler_weight_bits)) << 16;
+        }
+        break;
+    }
+
+    case texture_filter::bilinear:
+    default:
+        xy = sample_normal_xy(sampler, tex, static_cast<int>(lod + 0.5f), uv, true);
+        break;
+    }
+
+    return decode_normal_xy(static_cast<int>(xy & 0xffff), static_cast<int>(xy >> 16));
+}
+
+/*
+ * Blends four 8 byte material records, one record per register once widened to
+ * 16 bit lanes. Same fixed point math as bilinear_blend.
+ */
+inline void bilinear_blend_records(const unsigned char* c00, const unsigned char* c10, const unsigned char* c01, const unsigned char* c11, const int weight_x, const int weight_y, unsigned char* out)
+{
+#if USE_SSE2
+    const auto zero = _mm_setzero_si128();
+    const auto wx = _mm_set1_epi16(static_cast<short>(weight_x));
+    const auto wy = _mm_set1_epi16(static_cast<short>(weight_y));
+
+    const auto b0 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(c00)), zero);
+    const auto b1 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(c10)), zero);
+    const auto t0 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(c01)), zero);
+    const auto t1 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(c11)), zero);
+
+    const auto left = _mm_add_epi16(b0, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(t0, b0), wy), sampler_weight_bits));
+    const auto right = _mm_add_epi16(b1, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(t1, b1), wy), sampler_weight_bits));
+
+    const auto blended = _mm_add_epi16(left, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(right, left), wx), sampler_weight_bits));
+
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(blended, zero));
+#else
+    for (auto i = 0; i < 8; i++)
+    {
+        const auto left = c00[i] + (((c01[i] - c00[i]) * weight_y) >> sampler_weight_bits);
+        const auto right = c10[i] + (((c11[i] - c10[i]) * weight_y) >> sampler_weight_bits);
+
+        out[i] = static_cast<unsigned char>(left + (((right - left) * weight_x) >> sampler_weight_bits));
+    }
+#endif
+}
+
+inline void sample_material_level(const sampler& sampler, const texture& tex, const int level, const v2& uv, const bool bilinear, unsigned char* out)
+{
+    const auto& img = tex.levels[level];
+
+    if (!bilinear)
+    {
+        const auto x = address_texel(static_cast<int>(floorf(uv.x * static_cast<float>(img.width))), img.width, sampler.address);
+        const auto y = address_texel(static_cast<int>(floorf(uv.y * static_cast<float>(img.height))), img.height, sampler.address);
+
+        get_material_texel(tex, level, x, y, out);
+        return;
+    }
+
+    const auto f = get_bilinear_footprint(sampler, img, uv);
+
+    unsigned char c00[8], c10[8], c01[8], c11[8];
+    get_material_texel(tex, level, f.x0, f.y0, c00);
+    get_material_texel(tex, level, f.x1, f.y0, c10);
+    get_material_texel(tex, level, f.x0, f.y1, c01);
+    get_material_texel(tex, level, f.x1, f.y1, c11);
+
+    bilinear_blend_records(c00, c10, c01, c11, f.weight_x, f.weight_y, out);
+}
+
+inline material_sample sample_material(const sampler& sampler, const texture& tex, const v2& uv, float lod)
+{
+    assert(tex.format == texture_format::material8);
+
+    const auto max_level = tex.level_count - 1;
+
+    if (lod < 0) lod = 0;
+    if (lod > static_cast<float>(max_level)) lod = static_cast<float>(max_level);
+
+    unsigned char record[8];
+
+    switch (sampler.filter)
+    {
+    case texture_filter::nearest:
+        sample_material_level(sampler, tex, static_cast<int>(lod + 0.5f), uv, false, record);
+        break;
+
+    case texture_filter::trilinear: {
+        const auto level = static_cast<int>(lod);
+        const auto weight = static_cast<int>((lod - static_cast<float>(level)) * sampler_weight_one);
+
+        sample_material_level(sampler, tex, level, uv, true, record);
+
+        if (weight != 0 && level != max_level)
+        {
+            unsigned char coarse[8];
+            sample_material_level(sampler, tex, level + 1, uv, true, coarse);
+
+            for (auto i = 0; i < 8; i++)
+            {
+                record[i] = static_cast<unsigned char>(record[i] + (((coarse[i] - record[i]) * weight) >> sampler_weight_bits));
+            }
+        }
+        break;
+    }
+
+    case texture_filter::bilinear:
+    default:
+        sample_material_level(sampler, tex, static_cast<int>(lod + 0.5f), uv, true, record);
+        break;
+    }
+
+    material_sample ret;
+    memcpy(&ret.diffuse, record, sizeof(ret.diffuse));
+    ret.normal = decode_normal_xy(record[4], record[5]);
+    ret.spec_exponent = record[6];
+
+    return ret;
+}
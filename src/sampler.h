@@ -0,0 +1,70 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "maths.h"
+#include "image.h"
+#include "texture.h"
+
+/*
+ * Texture filtering and addressing, configured per sampler and shared by every
+ * texture it reads.
+ *
+ *  nearest   - single texel from the nearest mip level.
+ *  bilinear  - 2x2 texel blend from the nearest mip level.
+ *  trilinear - bilinear samples from the two closest mip levels, blended by lod.
+ *
+ * Blend weights are 7 bit fixed point, so texels are blended as 16 bit integers
+ * four channels at a time (or two texels at a time with SSE2).
+ */
+enum class texture_filter
+{
+    nearest,
+    bilinear,
+    trilinear,
+};
+
+static const int texture_filter_count = 3;
+
+/*
+ * How texel coordinates outside of the texture are resolved.
+ *
+ *  wrap   - repeat the texture.
+ *  clamp  - repeat the edge texels.
+ *  mirror - repeat the texture, flipping every other copy.
+ *
+ * Power of two sized levels resolve coordinates with masks rather than division.
+ */
+enum class texture_address
+{
+    wrap,
+    clamp,
+    mirror,
+};
+
+static const int texture_address_count = 3;
+
+struct sampler
+{
+    texture_filter filter = texture_filter::bilinear;
+    texture_address address = texture_address::wrap;
+};
+
+const char* texture_filter_name(texture_filter filter);
+const char* texture_address_name(texture_address address);
+
+inline rgba sample_texture(const sampler& sampler, const texture& tex, const v2& uv, float lod);
+
+//all of the maps stored in a material8 texel
+struct material_sample
+{
+    rgba diffuse;
+    v3 normal;
+    unsigned char spec_exponent;
+};
+
+inline material_sample sample_material(const sampler& sampler, const texture& tex, const v2& uv, float lod);
+
+//unit length tangent space normal from a normal_xy8 texture
+inline v3 sample_normal(const sampler& sampler, const texture& tex, const v2& uv, float lod);
+
+#endif
@@ -1,16 +1,14 @@
 #include <cmath>
+#include <cstring>
+#include <vector>
 
 #include "render.h"
 #include "file.h"
 #include "ui.h"
-
-v2_i get_tex_indicies(const v2& uv, const mesh& mesh)
-{
-    return {
-        static_cast<int>(uv.x * static_cast<float>(mesh.diffuse.width - 1)),
-        static_cast<int>(uv.y * static_cast<float>(mesh.diffuse.height - 1))
-    };
-}
+#include "lighting.h"
+#include "color.h"
+#include "shadow.h"
+#include "sampler.h"
 
 struct blinn_shader_normal_map final : public shader{
     m4 model_view_proj{};
@@ -18,9 +16,18 @@ struct blinn_shader_normal_map final : public shader{
 
     //outputs for fragment
     v3 ndc_vertex[3]{};
+    v3 view_vertex[3]{};
+    v3 shadow_vertex[3]{};
     v2 vertex_uv[3]{};
 
+    //specular evaluation method, trades accuracy for speed
+    specular_quality specular = specular_quality::fast_pow;
+
+    //filtering and addressing for the mesh maps
+    sampler texture_sampler{};
+
     const char* name() override { return "Blinn Normal Map"; }
+    bool uses_lights() override { return true; }
 
     void begin_pass() override
     {
@@ -38,6 +45,16 @@ struct blinn_shader_normal_map final : public shader{
             vertex_uv[vert_no] = mesh_to_draw->uvs[mesh_to_draw->faces[face_no].uv.e[vert_no]];
         }
 
+        //shadow map position
+        if(mesh_to_draw->allow_lighting && renderer_state->shadows != nullptr){
+            shadow_vertex[vert_no] = object_to_shadow_space(*renderer_state->shadows, vertex);
+        }
+
+        //view space position, used for dynamic lights
+        if(mesh_to_draw->allow_lighting && renderer_state->light_count > 0){
+            view_vertex[vert_no] = project_3d(renderer_state->model_view * project_4d(vertex));
+        }
+
         return ret;
     }
 
@@ -45,9 +62,23 @@ struct blinn_shader_normal_map final : public shader{
 
     bool fragment(const v3& bar, rgba & col, v3 interpolated_normal, v2 interpolated_uv, const v2_i& screen_pos) override
     {
-        const auto tex_indicies = get_tex_indicies(interpolated_uv, *mesh_to_draw);
-        
-        auto dif = get_pixel(mesh_to_draw->diffuse, tex_indicies.x, tex_indicies.y);
+        //interleaved maps are read with a single fetch, otherwise each map is sampled as it is needed
+        const auto packed = mesh_to_draw->has_material_texture;
+
+        //pick the mip level from the diffuse map, the other maps of a mesh reuse it
+        const auto lod = texture_lod(packed ? mesh_to_draw->material : mesh_to_draw->diffuse, uv_dx, uv_dy);
+
+        material_sample material{};
+        if (packed)
+        {
+            material = sample_material(texture_sampler, mesh_to_draw->material, interpolated_uv, lod);
+        }
+        else
+        {
+            material.diffuse = sample_texture(texture_sampler, mesh_to_draw->diffuse, interpolated_uv, lod);
+        }
+
+        auto dif = material.diffuse;
         col = dif;
 
         //skip lighting calculations
@@ -70,7 +101,7 @@ struct blinn_shader_normal_map final : public shader{
 
             auto b = m3{ i, j, interpolated_normal }.transpose();
 
-            normal = get_normal(mesh_to_draw->normal, tex_indicies.x, tex_indicies.y);
+            normal = packed ? material.normal : sample_normal(texture_sampler, mesh_to_draw->normal, interpolated_uv, lod);
 
             normal = (b * normal).normalise();
         }
@@ -89,23 +120,73 @@ struct blinn_shader_normal_map final : public shader{
         float spec = 0;
         if(mesh_to_draw->has_specular_map)
         {
-            auto spec_rgb = get_pixel(mesh_to_draw->spec, tex_indicies.x, tex_indicies.y);
+            const auto spec_exponent = packed ? material.spec_exponent : sample_texture(texture_sampler, mesh_to_draw->spec, interpolated_uv, lod).b;
 
             auto r = (normal * (normal.inner(l)) * 2 - l).normalise();
             if (r.z < 0) {
                 r.z = 0;
             }
             
-            spec = pow(r.z, 5 + spec_rgb.b);
+            spec = specular_power(r.z, spec_exponent, specular);
         }
         
-        col = col * (1.2f * diffuse + 0.6f * spec);
+        //attenuate the directional light by the shadow map
+        auto shadow = 1.0f;
+        if (renderer_state->shadows != nullptr)
+        {
+            const auto shadow_pos = shadow_vertex[0] * bar.x + shadow_vertex[1] * bar.y + shadow_vertex[2] * bar.z;
+            shadow = sample_shadow_pcf(*renderer_state->shadows, shadow_pos);
+        }
+
+        //scale by lighting and add in ambient color
+        col = color_scale_add(col, (1.2f * diffuse + 0.6f * spec) * shadow, dif, 0.15f);
+
+        //add dynamic lights that reach this pixel's screen tile
+        if (renderer_state->light_count > 0)
+        {
+            const auto position = view_vertex[0] * bar.x + view_vertex[1] * bar.y + view_vertex[2] * bar.z;
+            const auto light_col = shade_lights(*renderer_state, position, normal, screen_pos);
 
-        //add in ambient color
-        col = col + dif * 0.15f;
+            col = color_add(col, color_modulate(dif, light_col));
+        }
+
+        //self lit parts glow regardless of lighting, bloom picks them up from the frame
+        if (mesh_to_draw->has_emissive_map)
+        {
+            col = color_add(col, sample_texture(texture_sampler, mesh_to_draw->emission, interpolated_uv, lod));
+        }
 
         return true;
     }
+
+    void render_ui(v2_i& base_pos, ui_state& ui_state, output_buffers& output) override
+    {
+        auto quality_left = false, quality_right = false;
+        left_right_selector(base_pos, ui_state, output, "Specular", quality_left, quality_right);
+
+        if (quality_left || quality_right)
+        {
+            auto idx = (static_cast<int>(specular) + (quality_left ? -1 : 1)) % specular_quality_count;
+            if (idx < 0) idx = specular_quality_count - 1;
+
+            specular = static_cast<specular_quality>(idx);
+        }
+
+        labeled_string(base_pos, ui_state, output, "Specular:", specular_quality_name(specular));
+
+        auto filter_left = false, filter_right = false;
+        left_right_selector(base_pos, ui_state, output, "Filter", filter_left, filter_right);
+
+        if (filter_left || filter_right)
+        {
+            auto idx = (static_cast<int>(texture_sampler.filter) + (filter_left ? -1 : 1)) % texture_filter_count;
+            if (idx < 0) idx = texture_filter_count - 1;
+
+            texture_sampler.filter = static_cast<texture_filter>(idx);
+        }
+
+        labeled_string(base_pos, ui_state, output, "Filter:", texture_filter_name(texture_sampler.filter));
+    }
 };
 
 struct flat_shader final : public shader{
@@ -117,6 +198,7 @@ struct flat_shader final : public shader{
     float raise_factor{};
 
     const char* name() override { return "Flat"; }
+    bool uses_lights() override { return false; }
     
     void begin_pass() override
     {
@@ -171,37 +253,113 @@ struct flat_shader final : public shader{
 
         return true;
     }
+
+    void render_ui(v2_i& base_pos, ui_state& ui_state, output_buffers& output) override
+    {
+    }
 };
 
-struct chromatic_aberration final : public screen_space_effect
+//runs job(i) for i below count, on the renderer's workers when it has them
+template<typename function>
+static void for_each_job(render_state& state, const int count, const function& job)
 {
-    int red_offset = 1;
-    int green_offset = -1;
-    int blue_offset = -2;
+    if (state.workers != nullptr)
+    {
+        parallel_for(*state.workers, count, job);
+    }
+    else
+    {
+        for (auto i = 0; i < count; i++) job(i);
+    }
+}
 
-    static rgba sample_rgb_safe(int x, int y, image* buf)
+/*
+ * out[x] = { red[x].r, green[x].g, blue[x].b, 0 } for x in [x_begin, x_end), reads must
+ * be in bounds.
+ */
+static void combine_channels(
+    const rgba* red, const rgba* green, const rgba* blue, rgba* out, const int x_begin, const int x_end
+)
+{
+    auto x = x_begin;
+
+#if USE_SSE2
+    const auto red_mask = _mm_set1_epi32(0x000000ff);
+    const auto green_mask = _mm_set1_epi32(0x0000ff00);
+    const auto blue_mask = _mm_set1_epi32(0x00ff0000);
+
+    const auto load = [](const rgba* src) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    };
+
+    for (; x + 4 <= x_end; x += 4)
     {
-        if (x > buf->width - 1) x = buf->width - 1;
-        if (x < 0) x = 0;
-        if (y > buf->height - 1) y = buf->height - 1;
-        if (y < 0) y = 0;
+        const auto combined = _mm_or_si128(
+            _mm_or_si128(_mm_and_si128(load(red + x), red_mask), _mm_and_si128(load(green + x), green_mask)),
+            _mm_and_si128(load(blue + x), blue_mask)
+        );
 
-        return get_pixel(*buf, x, y);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), combined);
     }
+#endif
 
-    const char* name() override { return "Chromatic Aberration"; }
-
-    rgba apply(image* frame_buffer, int x, int y, const rgba& pixel) override
+    for (; x < x_end; x++)
     {
-        rgba res{};
+        out[x] = rgba{ red[x].r, green[x].g, blue[x].b, 0 };
+    }
+}
+
+struct chromatic_aberration final : public screen_space_effect
+{
+    int red_offset = 1;
+    int green_offset = -1;
+    int blue_offset = -2;
 
-        y = frame_buffer->height - 1 - y;
+    const char* name() override { return "Chromatic Aberration"; }
 
-        res.r = sample_rgb_safe(x + red_offset, y + red_offset, frame_buffer).r;
-        res.g = sample_rgb_safe(x + green_offset, y + green_offset, frame_buffer).g;
-        res.b = sample_rgb_safe(x + blue_offset, y + blue_offset, frame_buffer).b;
+    int footprint_rows() override
+    {
+        return std::max(std::max(abs(red_offset), abs(green_offset)), abs(blue_offset));
+    }
 
-        return  res;
+    /*
+     * Each channel is read from a copy of the frame shifted by its offset, clamped at
+     * the edges. Offsets are in screen space (bottom up), so they move rows the other
+     * way in the top down tile.
+     */
+    void apply_tile(const effect_tile& tile) override
+    {
+        const auto width = tile.input.width;
+        const auto max_x = width - 1;
+        const auto max_y = tile.input.height - 1;
+
+        //span where no channel's read is clamped, the rest is done a pixel at a time
+        const auto min_offset = std::min(std::min(red_offset, green_offset), blue_offset);
+        const auto max_offset = std::max(std::max(red_offset, green_offset), blue_offset);
+        const auto inner_begin = clamp(-min_offset, tile.x_min, tile.x_max);
+        const auto inner_end = clamp(width - max_offset, inner_begin, tile.x_max);
+
+        for (auto y = tile.y_min; y < tile.y_max; y++) {
+            const auto* red_row = tile.input.row(clamp(y - red_offset, 0, max_y));
+            const auto* green_row = tile.input.row(clamp(y - green_offset, 0, max_y));
+            const auto* blue_row = tile.input.row(clamp(y - blue_offset, 0, max_y));
+            auto* out = tile.output.row(y);
+
+            const auto clamped_span = [&](const int x_begin, const int x_end) {
+                for (auto x = x_begin; x < x_end; x++) {
+                    out[x] = rgba{
+                        red_row[clamp(x + red_offset, 0, max_x)].r,
+                        green_row[clamp(x + green_offset, 0, max_x)].g,
+                        blue_row[clamp(x + blue_offset, 0, max_x)].b,
+                        0
+                    };
+                }
+            };
+
+            clamped_span(tile.x_min, inner_begin);
+            combine_channels(red_row + red_offset, green_row + green_offset, blue_row + blue_offset, out, inner_begin, inner_end);
+            clamped_span(inner_end, tile.x_max);
+        }
     }
 
     void render_ui(v2_i& base_pos, ui_state& ui_state, output_buffers& output) override
@@ -230,80 +388,221 @@ struct chromatic_aberration final : public screen_space_effect
     }
 };
 
-inline float pixel_to_greyscale_float(const rgba& pixel)
+/*
+ * Edge detection works on a luma plane of r + g + b (0 - 765) per pixel, in 16 bit
+ * lanes, so a row of gradients is a handful of adds across 8 pixels at a time.
+ */
+static const int max_luma = 255 * 3;
+
+static void luma_row(const rgba* pixels, short* out, const int width)
 {
-    return static_cast<float>(pixel.r + pixel.g + pixel.b) / (255.0f * 3.0f);
+    auto x = 0;
+
+#if USE_SSE2
+    const auto byte_mask = _mm_set1_epi32(0xff);
+
+    const auto sum_channels = [&](const __m128i packed) {
+        const auto r = _mm_and_si128(packed, byte_mask);
+        const auto g = _mm_and_si128(_mm_srli_epi32(packed, 8), byte_mask);
+        const auto b = _mm_and_si128(_mm_srli_epi32(packed, 16), byte_mask);
+
+        return _mm_add_epi32(_mm_add_epi32(r, g), b);
+    };
+
+    for (; x + 8 <= width; x += 8)
+    {
+        const auto lo = sum_channels(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + x)));
+        const auto hi = sum_channels(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + x + 4)));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_packs_epi32(lo, hi));
+    }
+#endif
+
+    for (; x < width; x++)
+    {
+        out[x] = static_cast<short>(pixels[x].r + pixels[x].g + pixels[x].b);
+    }
 }
 
-struct sobel_filter final : public screen_space_effect
+/*
+ * |gx| + |gy| of the 3x3 sobel kernels, for x in [x_begin, x_end). Reads one column
+ * either side. At most 2 * 4 * 765, which fits 16 bit lanes.
+ */
+static void sobel_row(const short* above, const short* centre, const short* below, short* out, const int x_begin, const int x_end)
 {
-    const m3 gx{
-    -1, 0, 1,
-    -2, 0, 2,
-    -1, 0, 1
+    auto x = x_begin;
+
+#if USE_SSE2
+    const auto zero = _mm_setzero_si128();
+
+    const auto load = [](const short* src) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
     };
 
-    const m3 gy{
-        -1, -2, -1,
-        0, 0, 0,
-        1, 2, 1
+    const auto abs_epi16 = [&](const __m128i v) {
+        return _mm_max_epi16(v, _mm_sub_epi16(zero, v));
     };
 
-    float threshold = 0.2f;
-    
-    const char* name() override { return "Sobel Filter"; }
+    for (; x + 8 <= x_end; x += 8)
+    {
+        const auto a_l = load(above + x - 1), a_c = load(above + x), a_r = load(above + x + 1);
+        const auto c_l = load(centre + x - 1), c_r = load(centre + x + 1);
+        const auto b_l = load(below + x - 1), b_c = load(below + x), b_r = load(below + x + 1);
+
+        const auto c_diff = _mm_sub_epi16(c_r, c_l);
+        const auto gx = _mm_add_epi16(
+            _mm_add_epi16(_mm_sub_epi16(a_r, a_l), _mm_sub_epi16(b_r, b_l)),
+            _mm_add_epi16(c_diff, c_diff)
+        );
+
+        const auto gy = _mm_sub_epi16(
+            _mm_add_epi16(_mm_add_epi16(b_l, b_r), _mm_add_epi16(b_c, b_c)),
+            _mm_add_epi16(_mm_add_epi16(a_l, a_r), _mm_add_epi16(a_c, a_c))
+        );
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_add_epi16(abs_epi16(gx), abs_epi16(gy)));
+    }
+#endif
 
-    rgba apply(image* frame_buffer, int x, int y, const rgba& pixel) override
+    for (; x < x_end; x++)
     {
-        //only apply the shader to pixels where we have rendered something.
-        const auto z_val = renderer_state->output_buffers.z_buffer[y * renderer_state->output_buffers.frame_buffer.width + x];
-        if(!(z_val > min_z_buffer_val))
+        const auto gx =
+            (above[x + 1] - above[x - 1]) + 2 * (centre[x + 1] - centre[x - 1]) + (below[x + 1] - below[x - 1]);
+        const auto gy =
+            (below[x - 1] + 2 * below[x] + below[x + 1]) - (above[x - 1] + 2 * above[x] + above[x + 1]);
+
+        out[x] = static_cast<short>(abs(gx) + abs(gy));
+    }
+}
+
+/*
+ * Edge colors from gradients, for pixels with depth: dark grey under the threshold,
+ * otherwise grey at a third of the gradient (gradient / 765 * 255), clamped. Pixels
+ * without depth keep their color.
+ */
+static void sobel_output_row(
+    const rgba* in, const float* depth, const short* gradient, rgba* out,
+    const int x_begin, const int x_end, const int threshold
+)
+{
+    //x / 3 as (x * 21846) >> 16, exact for the gradient range
+    const auto third = 21846;
+    const rgba below_threshold{ 15, 15, 15, 15 };
+
+    auto x = x_begin;
+
+#if USE_SSE2
+    const auto zero = _mm_setzero_si128();
+    const auto no_depth = _mm_set1_ps(static_cast<float>(min_z_buffer_val));
+    const auto threshold_lanes = _mm_set1_epi32(threshold);
+    const auto max_channel = _mm_set1_epi16(255);
+
+    int below_packed;
+    memcpy(&below_packed, &below_threshold, sizeof(below_packed));
+    const auto below_lanes = _mm_set1_epi32(below_packed);
+
+    for (; x + 4 <= x_end; x += 4)
+    {
+        const auto grad = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(gradient + x));
+        const auto grey = _mm_min_epi16(_mm_mulhi_epu16(grad, _mm_set1_epi16(third)), max_channel);
+
+        const auto grad_32 = _mm_unpacklo_epi16(grad, zero);
+        const auto grey_32 = _mm_unpacklo_epi16(grey, zero);
+        const auto edge = _mm_or_si128(_mm_or_si128(grey_32, _mm_slli_epi32(grey_32, 8)), _mm_slli_epi32(grey_32, 16));
+
+        const auto weak = _mm_cmplt_epi32(grad_32, threshold_lanes);
+        const auto filtered = _mm_or_si128(_mm_and_si128(weak, below_lanes), _mm_andnot_si128(weak, edge));
+
+        const auto visible = _mm_castps_si128(_mm_cmpgt_ps(_mm_loadu_ps(depth + x), no_depth));
+        const auto original = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + x));
+
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i*>(out + x),
+            _mm_or_si128(_mm_and_si128(visible, filtered), _mm_andnot_si128(visible, original))
+        );
+    }
+#endif
+
+    for (; x < x_end; x++)
+    {
+        if (!(depth[x] > min_z_buffer_val))
         {
-            return pixel;
+            out[x] = in[x];
+            continue;
         }
-        
-        //can't filter edge pixels of image (need 3x3 matrix of surrounding pixels)
-        if (
-            x == 0 || x >= frame_buffer->width - 2 ||
-            y == 0 || y >= frame_buffer->height - 2
-        )
+
+        if (gradient[x] < threshold)
         {
-            return pixel;
+            out[x] = below_threshold;
+            continue;
         }
 
-        const auto width = frame_buffer->width;
+        const auto grey = std::min((gradient[x] * third) >> 16, 255);
+        out[x] = rgba{
+            static_cast<unsigned char>(grey),
+            static_cast<unsigned char>(grey),
+            static_cast<unsigned char>(grey),
+        };
+    }
+}
 
-        const rgba* data_rgb = reinterpret_cast<rgba*>(frame_buffer->data);
+//luma and gradient rows of the tile being filtered, one set per thread
+static thread_local std::vector<short> sobel_luma;
+static thread_local std::vector<short> sobel_gradient;
 
-        const m3 a{
-            pixel_to_greyscale_float(data_rgb[(y - 1) * width + x - 1]),
-            pixel_to_greyscale_float(data_rgb[(y - 1) * width + x]),
-            pixel_to_greyscale_float(data_rgb[(y - 1) * width + x + 1]),
+struct sobel_filter final : public screen_space_effect
+{
+    float threshold = 0.2f;
+    
+    const char* name() override { return "Sobel Filter"; }
 
-            pixel_to_greyscale_float(data_rgb[y * width + x - 1]),
-            pixel_to_greyscale_float(data_rgb[y * width + x]),
-            pixel_to_greyscale_float(data_rgb[y * width + x + 1]),
-        
-            pixel_to_greyscale_float(data_rgb[(y + 1) * width + x - 1]),
-            pixel_to_greyscale_float(data_rgb[(y + 1) * width + x]),
-            pixel_to_greyscale_float(data_rgb[(y + 1) * width + x + 1]),
-        };
-        
-        const auto s1 = (gx * a).sum();
-        const auto s2 = (gy * a).sum();
+    int footprint_rows() override { return 1; }
 
-        const auto res = abs(s1) + abs(s2);
-        
-        if (res < threshold) {
-            return rgba{ 15, 15, 15, 15 };
+    //edges are only drawn where there is depth
+    int coverage_margin() override { return 0; }
+
+    void apply_tile(const effect_tile& tile) override
+    {
+        const auto width = tile.input.width;
+        const auto height = tile.input.height;
+
+        //luma plane of the tile's pixels and the pixels around them, addressed by frame column
+        const auto plane_min = std::max(tile.y_min - 1, 0);
+        const auto plane_max = std::min(tile.y_max + 1, height);
+        const auto plane_x_min = std::max(tile.x_min - 1, 0);
+        const auto plane_x_max = std::min(tile.x_max + 1, width);
+
+        if (static_cast<int>(sobel_luma.size()) < (plane_max - plane_min) * width) sobel_luma.resize((plane_max - plane_min) * width);
+        if (static_cast<int>(sobel_gradient.size()) < width) sobel_gradient.resize(width);
+
+        for (auto y = plane_min; y < plane_max; y++) {
+            auto* plane_row = sobel_luma.data() + (y - plane_min) * width;
+            luma_row(tile.input.row(y) + plane_x_min, plane_row + plane_x_min, plane_x_max - plane_x_min);
         }
-        
-        return rgba{
-            static_cast<unsigned char>(res * 255), 
-            static_cast<unsigned char>(res * 255),
-            static_cast<unsigned char>(res * 255),
-        };
 
+        //threshold is in 0 - 1 luma, compare against whole gradient steps instead
+        const auto luma_threshold = static_cast<int>(ceilf(threshold * static_cast<float>(max_luma)));
+
+        //can't filter edge pixels of image (need 3x3 matrix of surrounding pixels)
+        const auto x_begin = std::max(tile.x_min, 1);
+        const auto x_end = std::min(tile.x_max, width - 2);
+
+        for (auto y = tile.y_min; y < tile.y_max; y++) {
+            const auto* in = tile.input.row(y);
+            auto* out = tile.output.row(y);
+
+            if (y == 0 || y >= height - 2 || x_begin >= x_end) {
+                memcpy(out + tile.x_min, in + tile.x_min, (tile.x_max - tile.x_min) * sizeof(rgba));
+                continue;
+            }
+
+            const auto* centre = sobel_luma.data() + (y - plane_min) * width;
+            sobel_row(centre - width, centre, centre + width, sobel_gradient.data(), x_begin, x_end);
+
+            for (auto x = tile.x_min; x < x_begin; x++) out[x] = in[x];
+            sobel_output_row(in, tile.depth_row(y), sobel_gradient.data(), out, x_begin, x_end, luma_threshold);
+            for (auto x = x_end; x < tile.x_max; x++) out[x] = in[x];
+        }
     }
 
     void render_ui(v2_i& base_pos, ui_state& ui_state, output_buffers& output) override
@@ -325,26 +624,43 @@ struct jumbo_pixels final : public screen_space_effect
     int pixel_size = 1;
 
     const char* name() override { return "Jumbo Pixels"; }
+
+    int footprint_rows() override { return 0; }
+
+    int coverage_margin() override { return 0; }
     
-    rgba apply(image* frame_buffer, int x, int y, const rgba& pixel) override
+    void apply_tile(const effect_tile& tile) override
     {
-        //only apply the shader to pixels where we have rendered something.
-        const auto z_val = renderer_state->output_buffers.z_buffer[y * renderer_state->output_buffers.frame_buffer.width + x];
-        if (!(z_val > min_z_buffer_val))
-        {
-            return pixel;
-        }
-        
-        x = x % (3 * pixel_size);
-        
-        if (x < pixel_size) {
-            return rgba{ pixel.r };
-        }
-        if (x < 2 * pixel_size) {
-            return rgba{ 0, pixel.g };
+        const auto period = 3 * pixel_size;
+
+        for (auto y = tile.y_min; y < tile.y_max; y++) {
+            const auto* in = tile.input.row(y);
+            const auto* depth = tile.depth_row(y);
+            auto* out = tile.output.row(y);
+
+            //position within the red, green, blue stripe pattern
+            auto phase = tile.x_min % period;
+
+            for (auto x = tile.x_min; x < tile.x_max; x++) {
+                const auto& pixel = in[x];
+
+                //only apply the shader to pixels where we have rendered something.
+                if (!(depth[x] > min_z_buffer_val)) {
+                    out[x] = pixel;
+                }
+                else if (phase < pixel_size) {
+                    out[x] = rgba{ pixel.r };
+                }
+                else if (phase < 2 * pixel_size) {
+                    out[x] = rgba{ 0, pixel.g };
+                }
+                else {
+                    out[x] = rgba{ 0, 0, pixel.b };
+                }
+
+                if (++phase == period) phase = 0;
+            }
         }
-        
-        return rgba{ 0, 0, pixel.b };
     }
 
     void render_ui(v2_i& base_pos, ui_state& ui_state, output_buffers& output) override
@@ -365,3 +681,1246 @@ struct jumbo_pixels final : public screen_space_effect
         pixel_size = 1;
     }
 };
+
+/*
+ * Bloom spreads the bright parts of the frame, such as emissive surfaces and strong
+ * highlights, over their surroundings. The frame is reduced to half, quarter and eighth
+ * size keeping only what is over the threshold, each level is box blurred, then the
+ * levels are added back up from the smallest and the result is added onto the frame.
+ */
+static const int bloom_level_count = 3;
+
+//columns blurred per job, each job keeps a running sum per column
+static const int bloom_strip_width = 64;
+
+struct bloom_level
+{
+    std::vector<rgba> pixels;
+    int width{}, height{};
+
+    rgba* row(const int y) { return pixels.data() + y * width; }
+    const rgba* row(const int y) const { return pixels.data() + y * width; }
+};
+
+//per channel average rounding up, as _mm_avg_epu8 does
+static rgba average(const rgba& a, const rgba& b)
+{
+    rgba ret;
+    for (auto i = 0; i < 4; i++)
+    {
+        ret.e[i] = static_cast<unsigned char>((a.e[i] + b.e[i] + 1) >> 1);
+    }
+
+    return ret;
+}
+
+/*
+ * A row of a half size image from two rows of the full size one, each pixel the average
+ * of a 2x2 block. The last column is repeated when in_width is odd.
+ */
+static void downsample_row(const rgba* top, const rgba* bottom, rgba* out, const int in_width, const int out_width)
+{
+    auto x = 0;
+
+#if USE_SSE2
+    const auto load = [](const rgba* src) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    };
+
+    for (; x + 4 <= out_width && 2 * x + 8 <= in_width; x += 4)
+    {
+        const auto left = _mm_castsi128_ps(_mm_avg_epu8(load(top + 2 * x), load(bottom + 2 * x)));
+        const auto right = _mm_castsi128_ps(_mm_avg_epu8(load(top + 2 * x + 4), load(bottom + 2 * x + 4)));
+
+        //split the 8 pixels into even and odd ones to average neighbours
+        const auto even = _mm_castps_si128(_mm_shuffle_ps(left, right, _MM_SHUFFLE(2, 0, 2, 0)));
+        const auto odd = _mm_castps_si128(_mm_shuffle_ps(left, right, _MM_SHUFFLE(3, 1, 3, 1)));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_avg_epu8(even, odd));
+    }
+#endif
+
+    for (; x < out_width; x++)
+    {
+        const auto x0 = 2 * x;
+        const auto x1 = std::min(x0 + 1, in_width - 1);
+
+        out[x] = average(average(top[x0], bottom[x0]), average(top[x1], bottom[x1]));
+    }
+}
+
+//copies pixels with depth, the rest become black
+static void depth_mask_row(const rgba* in, const float* depth, rgba* out, const int width)
+{
+    auto x = 0;
+
+#if USE_SSE2
+    const auto no_depth = _mm_set1_ps(static_cast<float>(min_z_buffer_val));
+
+    for (; x + 4 <= width; x += 4)
+    {
+        const auto visible = _mm_castps_si128(_mm_cmpgt_ps(_mm_loadu_ps(depth + x), no_depth));
+        const auto pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + x));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_and_si128(visible, pixels));
+    }
+#endif
+
+    for (; x < width; x++)
+    {
+        out[x] = depth[x] > min_z_buffer_val ? in[x] : rgba{ 0, 0, 0, 0 };
+    }
+}
+
+//subtracts the threshold from the color channels and clears alpha
+static void bright_pass_row(rgba* pixels, const int width, const unsigned char threshold)
+{
+    auto x = 0;
+
+#if USE_SSE2
+    //alpha less 255 is always 0
+    const auto cut = _mm_set1_epi32(static_cast<int>(0xff000000u | threshold * 0x010101u));
+
+    for (; x + 4 <= width; x += 4)
+    {
+        auto* dst = reinterpret_cast<__m128i*>(pixels + x);
+        _mm_storeu_si128(dst, _mm_subs_epu8(_mm_loadu_si128(dst), cut));
+    }
+#endif
+
+    for (; x < width; x++)
+    {
+        for (auto i = 0; i < 3; i++)
+        {
+            pixels[x].e[i] = static_cast<unsigned char>(std::max(pixels[x].e[i] - threshold, 0));
+        }
+
+        pixels[x].a = 0;
+    }
+}
+
+/*
+ * Box blurs keep a running sum of the window, adding the pixel entering it and removing
+ * the one leaving, so the cost per pixel doesn't depend on the radius. Sums of up to
+ * max_bloom_radius * 2 + 1 channels fit 16 bit lanes, and are divided by the window size
+ * as (sum * inverse) >> 16. Channels are summed alpha included, which stays 0 in bloom
+ * levels.
+ */
+static const int max_bloom_radius = 16;
+
+//ceil(65536 / box size), exact for sums that are multiples of the box size
+static unsigned short box_inverse(const int radius)
+{
+    assert(radius >= 1 && radius <= max_bloom_radius);
+
+    const auto box_size = 2 * radius + 1;
+    return static_cast<unsigned short>((65536 + box_size - 1) / box_size);
+}
+
+static void box_blur_row(const rgba* in, rgba* out, const int width, const int radius)
+{
+    const auto inverse = box_inverse(radius);
+    const auto last = width - 1;
+
+    //the sum moves along the row, clamped reads are only needed near its ends
+    const auto inner_begin = std::min(radius, width);
+    const auto inner_end = std::max(width - radius - 1, inner_begin);
+
+#if USE_SSE2
+    const auto zero = _mm_setzero_si128();
+    const auto inverse_lanes = _mm_set1_epi16(static_cast<short>(inverse));
+
+    const auto widen = [&](const rgba& pixel) {
+        return _mm_unpacklo_epi8(load_rgba(pixel), zero);
+    };
+
+    auto sum = zero;
+    for (auto k = -radius; k <= radius; k++) sum = _mm_add_epi16(sum, widen(in[clamp(k, 0, last)]));
+
+    const auto step = [&](const int x, const rgba& entering, const rgba& leaving) {
+        out[x] = store_rgba(_mm_packus_epi16(_mm_mulhi_epu16(sum, inverse_lanes), zero));
+        sum = _mm_add_epi16(sum, _mm_sub_epi16(widen(entering), widen(leaving)));
+    };
+#else
+    unsigned short sum[4]{};
+    for (auto k = -radius; k <= radius; k++)
+    {
+        for (auto i = 0; i < 4; i++) sum[i] += in[clamp(k, 0, last)].e[i];
+    }
+
+    const auto step = [&](const int x, const rgba& entering, const rgba& leaving) {
+        for (auto i = 0; i < 4; i++)
+        {
+            out[x].e[i] = static_cast<unsigned char>((sum[i] * inverse) >> 16);
+            sum[i] += entering.e[i] - leaving.e[i];
+        }
+    };
+#endif
+
+    for (auto x = 0; x < inner_begin; x++) step(x, in[clamp(x + radius + 1, 0, last)], in[0]);
+    for (auto x = inner_begin; x < inner_end; x++) step(x, in[x + radius + 1], in[x - radius]);
+    for (auto x = inner_end; x < width; x++) step(x, in[last], in[clamp(x - radius, 0, last)]);
+}
+
+//running sums of a strip of columns, one set per thread
+static thread_local std::vector<unsigned short> bloom_column_sums;
+
+static void box_blur_columns(const bloom_level& in, bloom_level& out, const int x_begin, const int x_end, const int radius)
+{
+    const auto inverse = box_inverse(radius);
+    const auto last = in.height - 1;
+
+    //4 channels per pixel
+    const auto count = (x_end - x_begin) * 4;
+
+    auto& sums = bloom_column_sums;
+    sums.assign(count, 0);
+
+    const auto channels = [&](const int y) {
+        return reinterpret_cast<const unsigned char*>(in.row(clamp(y, 0, last)) + x_begin);
+    };
+
+    for (auto k = -radius; k <= radius; k++)
+    {
+        const auto* row = channels(k);
+        for (auto i = 0; i < count; i++) sums[i] += row[i];
+    }
+
+    for (auto y = 0; y < in.height; y++)
+    {
+        auto* out_row = reinterpret_cast<unsigned char*>(out.row(y) + x_begin);
+        const auto* entering = channels(y + radius + 1);
+        const auto* leaving = channels(y - radius);
+        auto* sum = sums.data();
+
+        auto i = 0;
+
+#if USE_SSE2
+        const auto zero = _mm_setzero_si128();
+        const auto inverse_lanes = _mm_set1_epi16(static_cast<short>(inverse));
+
+        for (; i + 16 <= count; i += 16)
+        {
+            const auto sum_lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sum + i));
+            const auto sum_hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sum + i + 8));
+
+            _mm_storeu_si128(
+                reinterpret_cast<__m128i*>(out_row + i),
+                _mm_packus_epi16(_mm_mulhi_epu16(sum_lo, inverse_lanes), _mm_mulhi_epu16(sum_hi, inverse_lanes))
+            );
+
+            const auto enter = _mm_loadu_si128(reinterpret_cast<const __m128i*>(entering + i));
+            const auto leave = _mm_loadu_si128(reinterpret_cast<const __m128i*>(leaving + i));
+
+            const auto change_lo = _mm_sub_epi16(_mm_unpacklo_epi8(enter, zero), _mm_unpacklo_epi8(leave, zero));
+            const auto change_hi = _mm_sub_epi16(_mm_unpackhi_epi8(enter, zero), _mm_unpackhi_epi8(leave, zero));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(sum + i), _mm_add_epi16(sum_lo, change_lo));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(sum + i + 8), _mm_add_epi16(sum_hi, change_hi));
+        }
+#endif
+
+        for (; i < count; i++)
+        {
+            out_row[i] = static_cast<unsigned char>((sum[i] * inverse) >> 16);
+            sum[i] = static_cast<unsigned short>(sum[i] + entering[i] - leaving[i]);
+        }
+    }
+}
+
+/*
+ * Bilinear 2x upsampling, each output pixel takes 9/16 of the nearest source pixel, 3/16
+ * of the next nearest in x and in y, and 1/16 of the diagonal one. upsample_mix_rows
+ * blends the nearest source row 3:1 with the next into 16 bit lanes, with a clamped
+ * pixel either side, then upsample_expand_row blends along the row and rounds.
+ */
+static void upsample_mix_rows(const rgba* near_row, const rgba* far_row, short* mixed, const int width)
+{
+    auto* centre = mixed + 4;
+    auto x = 0;
+
+#if USE_SSE2
+    const auto zero = _mm_setzero_si128();
+
+    for (; x + 4 <= width; x += 4)
+    {
+        const auto near_pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(near_row + x));
+        const auto far_pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(far_row + x));
+
+        const auto mix = [&](const __m128i near_lanes, const __m128i far_lanes) {
+            return _mm_add_epi16(_mm_add_epi16(near_lanes, near_lanes), _mm_add_epi16(near_lanes, far_lanes));
+        };
+
+        const auto lo = mix(_mm_unpacklo_epi8(near_pixels, zero), _mm_unpacklo_epi8(far_pixels, zero));
+        const auto hi = mix(_mm_unpackhi_epi8(near_pixels, zero), _mm_unpackhi_epi8(far_pixels, zero));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(centre + x * 4), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(centre + x * 4 + 8), hi);
+    }
+#endif
+
+    for (; x < width; x++)
+    {
+        for (auto i = 0; i < 4; i++)
+        {
+            centre[x * 4 + i] = static_cast<short>(3 * near_row[x].e[i] + far_row[x].e[i]);
+        }
+    }
+
+    memcpy(mixed, centre, 4 * sizeof(short));
+    memcpy(centre + width * 4, centre + (width - 1) * 4, 4 * sizeof(short));
+}
+
+//writes 2 * width pixels from a row of upsample_mix_rows
+static void upsample_expand_row(const short* mixed, rgba* out, const int width)
+{
+    const auto* centre = mixed + 4;
+    auto x = 0;
+
+#if USE_SSE2
+    const auto round = _mm_set1_epi16(8);
+
+    const auto load = [](const short* src) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    };
+
+    for (; x + 2 <= width; x += 2)
+    {
+        const auto current = load(centre + x * 4);
+        const auto current_3 = _mm_add_epi16(_mm_add_epi16(current, current), _mm_add_epi16(current, round));
+
+        //pixels 2x and 2x + 2 lean left, 2x + 1 and 2x + 3 lean right
+        const auto even = _mm_srli_epi16(_mm_add_epi16(current_3, load(centre + (x - 1) * 4)), 4);
+        const auto odd = _mm_srli_epi16(_mm_add_epi16(current_3, load(centre + (x + 1) * 4)), 4);
+
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i*>(out + 2 * x),
+            _mm_packus_epi16(_mm_unpacklo_epi64(even, odd), _mm_unpackhi_epi64(even, odd))
+        );
+    }
+#endif
+
+    for (; x < width; x++)
+    {
+        for (auto i = 0; i < 4; i++)
+        {
+            const auto current_3 = 3 * centre[x * 4 + i] + 8;
+
+            out[2 * x].e[i] = static_cast<unsigned char>((current_3 + centre[(x - 1) * 4 + i]) >> 4);
+            out[2 * x + 1].e[i] = static_cast<unsigned char>((current_3 + centre[(x + 1) * 4 + i]) >> 4);
+        }
+    }
+}
+
+//depth masked frame rows and upsampling rows, one set per thread
+static thread_local std::vector<rgba> bloom_masked_rows;
+static thread_local std::vector<short> bloom_mixed;
+static thread_local std::vector<rgba> bloom_upsampled;
+
+//row y of the level at twice its size, into bloom_upsampled
+static const rgba* upsample_row(const bloom_level& level, const int y)
+{
+    if (static_cast<int>(bloom_mixed.size()) < (level.width + 2) * 4) bloom_mixed.resize((level.width + 2) * 4);
+    if (static_cast<int>(bloom_upsampled.size()) < level.width * 2) bloom_upsampled.resize(level.width * 2);
+
+    const auto near_y = y / 2;
+    const auto far_y = clamp(y % 2 == 0 ? near_y - 1 : near_y + 1, 0, level.height - 1);
+
+    upsample_mix_rows(level.row(near_y), level.row(far_y), bloom_mixed.data(), level.width);
+    upsample_expand_row(bloom_mixed.data(), bloom_upsampled.data(), level.width);
+
+    return bloom_upsampled.data();
+}
+
+struct bloom final : public screen_space_effect
+{
+    float threshold = 0.7f;
+    float intensity = 1.0f;
+    int radius = 2;
+
+    bloom_level levels[bloom_level_count];
+    bloom_level blur_temp;
+
+    const char* name() override { return "Bloom"; }
+
+    //the pyramid is built from the whole frame before the pass
+    int footprint_rows() override { return -1; }
+
+    //blurred at up to eighth size, then each upsample smears a little further
+    int coverage_margin() override { return (1 << bloom_level_count) * (radius + 3); }
+
+    void begin_pass(const image_view& input) override
+    {
+        auto width = input.width;
+        auto height = input.height;
+
+        for (auto& level : levels)
+        {
+            width = (width + 1) / 2;
+            height = (height + 1) / 2;
+
+            level.width = width;
+            level.height = height;
+            if (static_cast<int>(level.pixels.size()) < width * height) level.pixels.resize(width * height);
+        }
+
+        //sized for the largest level, rows are addressed at the width of the level being blurred
+        if (blur_temp.pixels.size() < levels[0].pixels.size()) blur_temp.pixels.resize(levels[0].pixels.size());
+
+        const auto cut = static_cast<unsigned char>(threshold * 255.0f);
+
+        //only what has been rendered glows, the background is left out like other effects do
+        const auto* depth = renderer_state->output_buffers.z_buffer;
+
+        for_each_job(*renderer_state, levels[0].height, [&](const int y) {
+            auto& masked = bloom_masked_rows;
+            if (static_cast<int>(masked.size()) < 2 * input.width) masked.resize(2 * input.width);
+
+            const auto top = 2 * y;
+            const auto bottom = std::min(top + 1, input.height - 1);
+
+            depth_mask_row(input.row(top), depth + top * input.width, masked.data(), input.width);
+            depth_mask_row(input.row(bottom), depth + bottom * input.width, masked.data() + input.width, input.width);
+
+            auto* out = levels[0].row(y);
+            downsample_row(masked.data(), masked.data() + input.width, out, input.width, levels[0].width);
+            bright_pass_row(out, levels[0].width, cut);
+        });
+
+        for (auto i = 1; i < bloom_level_count; i++)
+        {
+            const auto& larger = levels[i - 1];
+            auto& level = levels[i];
+
+            for_each_job(*renderer_state, level.height, [&](const int y) {
+                downsample_row(larger.row(2 * y), larger.row(std::min(2 * y + 1, larger.height - 1)), level.row(y), larger.width, level.width);
+            });
+        }
+
+        for (auto& level : levels) blur(level);
+
+        //add each level onto the next larger one, from the smallest up
+        for (auto i = bloom_level_count - 1; i > 0; i--)
+        {
+            const auto& level = levels[i];
+            auto& larger = levels[i - 1];
+
+            for_each_job(*renderer_state, larger.height, [&](const int y) {
+                color_add_span(larger.row(y), larger.row(y), upsample_row(level, y), larger.width);
+            });
+        }
+
+        //scale once at half size rather than for every pixel of the frame
+        for_each_job(*renderer_state, levels[0].height, [&](const int y) {
+            color_scale_span(levels[0].row(y), levels[0].row(y), intensity, levels[0].width);
+        });
+    }
+
+    void apply_tile(const effect_tile& tile) override
+    {
+        const auto& level = levels[0];
+        assert(level.width == (tile.input.width + 1) / 2 && level.height == (tile.input.height + 1) / 2);
+
+        for (auto y = tile.y_min; y < tile.y_max; y++) {
+            const auto* glow = upsample_row(level, y);
+
+            color_add_span(tile.output.row(y) + tile.x_min, tile.input.row(y) + tile.x_min, glow + tile.x_min, tile.x_max - tile.x_min);
+        }
+    }
+
+    void render_ui(v2_i& base_pos, ui_state& ui_state, output_buffers& output) override
+    {
+        float_selector(base_pos, output, ui_state, threshold, 0.05f);
+        increment_col(base_pos, ui_state);
+        blit_string(base_pos, "Threshold", ui_state, output, ui_state.text_col);
+        increment_row(base_pos, ui_state);
+
+        float_selector(base_pos, output, ui_state, intensity, 0.1f);
+        increment_col(base_pos, ui_state);
+        blit_string(base_pos, "Intensity", ui_state, output, ui_state.text_col);
+        increment_row(base_pos, ui_state);
+
+        int_selector(base_pos, output, ui_state, radius, 1);
+        increment_col(base_pos, ui_state);
+        blit_string(base_pos, "Radius", ui_state, output, ui_state.text_col);
+        increment_row(base_pos, ui_state);
+
+        //keep the settings in range of the fixed point math
+        threshold = std::min(std::max(threshold, 0.0f), 1.0f);
+        intensity = std::min(std::max(intensity, 0.0f), 4.0f);
+        radius = clamp(radius, 1, max_bloom_radius);
+    }
+
+    void reset_settings() override
+    {
+        threshold = 0.7f;
+        intensity = 1.0f;
+        radius = 2;
+    }
+
+    //separable box blur, rows into blur_temp then columns back into the level
+    void blur(bloom_level& level)
+    {
+        blur_temp.width = level.width;
+        blur_temp.height = level.height;
+
+        for_each_job(*renderer_state, level.height, [&](const int y) {
+            box_blur_row(level.row(y), blur_temp.row(y), level.width, radius);
+        });
+
+        const auto strip_count = (level.width + bloom_strip_width - 1) / bloom_strip_width;
+
+        for_each_job(*renderer_state, strip_count, [&](const int strip) {
+            const auto x_begin = strip * bloom_strip_width;
+            box_blur_columns(blur_temp, level, x_begin, std::min(x_begin + bloom_strip_width, level.width), radius);
+        });
+    }
+};
+
+/*
+ * Screen space ambient occlusion from the depth buffer, estimated at half or quarter
+ * resolution. Each pixel compares its depth against pairs of samples mirrored about it,
+ * on a small disk that is rotated in a 4x4 pattern so neighbouring pixels sample
+ * different directions. A pair only occludes when its average stands in front of the
+ * pixel, so flat surfaces at any angle are left alone without needing normals. A 4x4
+ * depth aware blur averages the pattern out, then every full resolution pixel blends
+ * the reduced samples around it that lie at a similar depth.
+ */
+static const int ao_pair_count = 4;
+static const int ao_pattern_size = 4;
+static const int ao_rotation_count = ao_pattern_size * ao_pattern_size;
+
+//rotation used at each position of the 4x4 pattern, spread so neighbours differ the most
+static const int ao_rotation_pattern[ao_rotation_count] = {
+    0, 8, 2, 10,
+    12, 4, 14, 6,
+    3, 11, 1, 9,
+    15, 7, 13, 5,
+};
+
+//how much a reduced sample counts when its depth doesn't match the pixel being upsampled
+static const float ao_depth_mismatch_weight = 0.001f;
+
+//depth difference still treated as the same surface, in reduced pixels
+static const float ao_surface_tolerance = 4.0f;
+
+//samples further in front of a pixel than this many disk radii are other objects, not creases
+static const float ao_max_rise_radii = 2.0f;
+
+/*
+ * ao_surface_tolerance in depth buffer units, at a given depth. A depth unit covers
+ * fewer pixels the further away it is, in proportion to w, which is linear in depth.
+ */
+struct ao_depth_tolerance
+{
+    float base;
+    float slope;
+
+    inline float at(float depth) const;
+};
+
+inline float ao_depth_tolerance::at(const float depth) const
+{
+    return base + slope * depth;
+}
+
+//where each full resolution column falls between reduced columns, one table per thread
+struct ao_column
+{
+    int lower, upper;
+    float blend;
+};
+
+static thread_local std::vector<ao_column> ao_columns;
+
+/*
+ * The 4 tap depth aware blur of visibility, along rows when stride is 1 or down columns
+ * when it is the width. The taps before the centre and the two after it are averaged in
+ * when their depth is within tolerance of the centre's.
+ */
+static const int ao_blur_taps[3] = { -1, 1, 2 };
+
+//a single sample at position pos of a line of size samples, taps off either end are left out
+static void ao_blur_clamped(
+    const float* in, const float* depth, float* out, const int idx, const int pos, const int size,
+    const int stride, const ao_depth_tolerance& tolerance
+)
+{
+    const auto limit = tolerance.at(depth[idx]);
+    auto sum = in[idx];
+    auto count = 1.0f;
+
+    for (const auto k : ao_blur_taps)
+    {
+        if (pos + k < 0 || pos + k >= size) continue;
+
+        const auto sample = idx + k * stride;
+        if (fabsf(depth[sample] - depth[idx]) < limit)
+        {
+            sum += in[sample];
+            count += 1.0f;
+        }
+    }
+
+    out[idx] = sum / count;
+}
+
+//samples [begin, end) whose taps are all in bounds, 4 at a time. Rejected taps add 0, so
+//the sums match ao_blur_clamped's exactly
+static void ao_blur_span(
+    const float* in, const float* depth, float* out, const int begin, const int end,
+    const int stride, const ao_depth_tolerance& tolerance
+)
+{
+    auto idx = begin;
+
+#if USE_SSE2
+    const auto abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const auto tolerance_base = _mm_set1_ps(tolerance.base);
+    const auto tolerance_slope = _mm_set1_ps(tolerance.slope);
+    const auto one = _mm_set1_ps(1.0f);
+
+    for (; idx + 4 <= end; idx += 4)
+    {
+        const auto centre = _mm_loadu_ps(depth + idx);
+        const auto limit = _mm_add_ps(tolerance_base, _mm_mul_ps(tolerance_slope, centre));
+        auto sum = _mm_loadu_ps(in + idx);
+        auto count = one;
+
+        for (const auto k : ao_blur_taps)
+        {
+            const auto sample = idx + k * stride;
+            const auto difference = _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(depth + sample), centre), abs_mask);
+            const auto same_surface = _mm_cmplt_ps(difference, limit);
+
+            sum = _mm_add_ps(sum, _mm_and_ps(same_surface, _mm_loadu_ps(in + sample)));
+            count = _mm_add_ps(count, _mm_and_ps(same_surface, one));
+        }
+
+        _mm_storeu_ps(out + idx, _mm_div_ps(sum, count));
+    }
+#endif
+
+    for (; idx < end; idx++)
+    {
+        const auto limit = tolerance.at(depth[idx]);
+        auto sum = in[idx];
+        auto count = 1.0f;
+
+        for (const auto k : ao_blur_taps)
+        {
+            const auto sample = idx + k * stride;
+            const auto same_surface = fabsf(depth[sample] - depth[idx]) < limit;
+
+            sum += same_surface ? in[sample] : 0.0f;
+            count += same_surface ? 1.0f : 0.0f;
+        }
+
+        out[idx] = sum / count;
+    }
+}
+
+struct ambient_occlusion final : public screen_space_effect
+{
+    //disk radius in full resolution pixels
+    float radius = 16.0f;
+    float strength = 2.0f;
+    bool quarter_resolution = false;
+
+    //reduced resolution depth and visibility, 1 unoccluded to 0 fully occluded
+    std::vector<float> depth;
+    std::vector<float> visibility;
+    std::vector<float> blur_temp;
+    int width{}, height{};
+    int scale{};
+
+    //ao_surface_tolerance in depth buffer units, for the blur and upsample
+    ao_depth_tolerance tolerance{};
+
+    const char* name() override { return "Ambient Occlusion"; }
+
+    //occlusion is worked out for the whole frame before the pass
+    int footprint_rows() override { return -1; }
+
+    int coverage_margin() override { return 0; }
+
+    void begin_pass(const image_view& input) override
+    {
+        scale = quarter_resolution ? 4 : 2;
+        width = (input.width + scale - 1) / scale;
+        height = (input.height + scale - 1) / scale;
+
+        const auto size = static_cast<size_t>(width * height);
+        if (depth.size() < size) depth.resize(size);
+        if (visibility.size() < size) visibility.resize(size);
+        if (blur_temp.size() < size) blur_temp.resize(size);
+
+        /*
+         * Depth is compared in reduced pixels. The z buffer holds view space depth, which
+         * the projection leaves unscaled, so a depth unit spans as many pixels as a unit
+         * across the screen at that depth: the viewport's scale divided by w = 1 - z / c.
+         */
+        const auto pixels_per_depth = renderer_state->viewport.r1.x / static_cast<float>(scale);
+        const auto w_per_depth = renderer_state->projection.r4.z;
+        const auto sample_radius = std::max(radius / static_cast<float>(scale), 2.0f);
+        const auto max_rise = ao_max_rise_radii * sample_radius;
+
+        tolerance.base = ao_surface_tolerance / pixels_per_depth;
+        tolerance.slope = tolerance.base * w_per_depth;
+
+        //a spiral of pair offsets per rotation, so the pattern covers the disk between them
+        v2_i kernel[ao_rotation_count][ao_pair_count];
+        for (auto r = 0; r < ao_rotation_count; r++)
+        {
+            for (auto i = 0; i < ao_pair_count; i++)
+            {
+                const auto t = (static_cast<float>(i) + (static_cast<float>(r) + 0.5f) / ao_rotation_count) / ao_pair_count;
+                const auto angle = static_cast<float>(M_PI) * t;
+                const auto distance = 1.0f + (sample_radius - 1.0f) * t;
+
+                kernel[r][i] = v2_i{
+                    static_cast<int>(roundf(cosf(angle) * distance)),
+                    static_cast<int>(roundf(sinf(angle) * distance)),
+                };
+            }
+        }
+
+        //point sample depth at the middle of each block
+        const auto* z_buffer = renderer_state->output_buffers.z_buffer;
+
+        for_each_job(*renderer_state, height, [&](const int y) {
+            const auto* src = z_buffer + std::min(y * scale + scale / 2, input.height - 1) * input.width;
+            auto* dst = depth.data() + y * width;
+
+            for (auto x = 0; x < width; x++)
+            {
+                dst[x] = src[std::min(x * scale + scale / 2, input.width - 1)];
+            }
+        });
+
+        for_each_job(*renderer_state, height, [&](const int y) {
+            const auto sample_depth = [&](const int x, const int y) {
+                return depth[clamp(y, 0, height - 1) * width + clamp(x, 0, width - 1)];
+            };
+
+            for (auto x = 0; x < width; x++)
+            {
+                const auto centre = depth[y * width + x];
+                auto& out = visibility[y * width + x];
+
+                //only apply the shader to pixels where we have rendered something.
+                if (!(centre > min_z_buffer_val))
+                {
+                    out = 1.0f;
+                    continue;
+                }
+
+                const auto& pairs = kernel[ao_rotation_pattern[(y % ao_pattern_size) * ao_pattern_size + x % ao_pattern_size]];
+                const auto depth_scale = pixels_per_depth / (1.0f + w_per_depth * centre);
+                auto occlusion = 0.0f;
+
+                for (const auto& offset : pairs)
+                {
+                    //height of each sample above the pixel, toward the camera. The background is far
+                    //behind everything so never occludes
+                    const auto rise_a = (sample_depth(x + offset.x, y + offset.y) - centre) * depth_scale;
+                    const auto rise_b = (sample_depth(x - offset.x, y - offset.y) - centre) * depth_scale;
+
+                    //objects far in front of the pixel don't shade it, and would leave a halo around them
+                    if (rise_a > max_rise || rise_b > max_rise) continue;
+
+                    //a flat surface rises on one side as much as it falls on the other, a crease rises on both
+                    const auto rise = 0.5f * (rise_a + rise_b);
+                    if (rise <= 0) continue;
+
+                    //sine of the angle the pair rises above the pixel
+                    const auto distance_sq = static_cast<float>(offset.x * offset.x + offset.y * offset.y);
+                    occlusion += rise / sqrtf(distance_sq + rise * rise);
+                }
+
+                out = std::max(1.0f - strength * occlusion / ao_pair_count, 0.0f);
+            }
+        });
+
+        //4x4 box over samples of the same surface, the size of the rotation pattern
+        const auto* reduced_depth = depth.data();
+
+        for_each_job(*renderer_state, height, [&](const int y) {
+            const auto row = y * width;
+
+            if (width < ao_pattern_size)
+            {
+                for (auto x = 0; x < width; x++) ao_blur_clamped(visibility.data(), reduced_depth, blur_temp.data(), row + x, x, width, 1, tolerance);
+                return;
+            }
+
+            ao_blur_clamped(visibility.data(), reduced_depth, blur_temp.data(), row, 0, width, 1, tolerance);
+            ao_blur_span(visibility.data(), reduced_depth, blur_temp.data(), row + 1, row + width - 2, 1, tolerance);
+
+            for (auto x = width - 2; x < width; x++)
+            {
+                ao_blur_clamped(visibility.data(), reduced_depth, blur_temp.data(), row + x, x, width, 1, tolerance);
+            }
+        });
+
+        for_each_job(*renderer_state, height, [&](const int y) {
+            const auto row = y * width;
+
+            if (y >= 1 && y + 2 < height)
+            {
+                ao_blur_span(blur_temp.data(), reduced_depth, visibility.data(), row, row + width, width, tolerance);
+                return;
+            }
+
+            for (auto x = 0; x < width; x++)
+            {
+                ao_blur_clamped(blur_temp.data(), reduced_depth, visibility.data(), row + x, y, height, width, tolerance);
+            }
+        });
+    }
+
+    void apply_tile(const effect_tile& tile) override
+    {
+        const auto inverse_scale = 1.0f / static_cast<float>(scale);
+
+        //position of a full resolution pixel in the reduced image, the two samples either side and the blend between them
+        const auto locate = [&](const int pos, const int size, int& lower, int& upper, float& blend) {
+            const auto reduced = (static_cast<float>(pos) + 0.5f) * inverse_scale - 0.5f;
+
+            lower = clamp(static_cast<int>(floorf(reduced)), 0, size - 1);
+            upper = std::min(lower + 1, size - 1);
+            blend = std::min(std::max(reduced - static_cast<float>(lower), 0.0f), 1.0f);
+        };
+
+        //columns are located the same way on every row
+        auto& columns = ao_columns;
+        if (static_cast<int>(columns.size()) < tile.x_max) columns.resize(tile.x_max);
+
+        for (auto x = tile.x_min; x < tile.x_max; x++) {
+            locate(x, width, columns[x].lower, columns[x].upper, columns[x].blend);
+        }
+
+        const auto* reduced_depth = depth.data();
+        const auto* reduced_visibility = visibility.data();
+
+        for (auto y = tile.y_min; y < tile.y_max; y++) {
+            const auto* in = tile.input.row(y);
+            const auto* z = tile.depth_row(y);
+            auto* out = tile.output.row(y);
+
+            int y0, y1;
+            float blend_y;
+            locate(y, height, y0, y1, blend_y);
+
+            for (auto x = tile.x_min; x < tile.x_max; x++) {
+                //only apply the shader to pixels where we have rendered something.
+                if (!(z[x] > min_z_buffer_val)) {
+                    out[x] = in[x];
+                    continue;
+                }
+
+                const auto& column = columns[x];
+                const int taps[4] = {
+                    y0 * width + column.lower, y0 * width + column.upper,
+                    y1 * width + column.lower, y1 * width + column.upper,
+                };
+                const float bilinear[4] = {
+                    (1.0f - column.blend) * (1.0f - blend_y), column.blend * (1.0f - blend_y),
+                    (1.0f - column.blend) * blend_y, column.blend * blend_y,
+                };
+
+                //bilinear weights, mostly ignoring samples from other surfaces
+                const auto limit = tolerance.at(z[x]);
+                auto sum = 0.0f;
+                auto total = 0.0f;
+                for (auto i = 0; i < 4; i++)
+                {
+                    const auto same_surface = fabsf(reduced_depth[taps[i]] - z[x]) < limit;
+                    const auto weight = bilinear[i] * (same_surface ? 1.0f : ao_depth_mismatch_weight);
+
+                    sum += reduced_visibility[taps[i]] * weight;
+                    total += weight;
+                }
+
+                //alpha is scaled too, effects don't keep it
+                out[x] = color_scale(in[x], total > 0 ? sum / total : 1.0f);
+            }
+        }
+    }
+
+    void render_ui(v2_i& base_pos, ui_state& ui_state, output_buffers& output) override
+    {
+        labeled_toggle(base_pos, ui_state, output, "Quarter Res", quarter_resolution);
+
+        float_selector(base_pos, output, ui_state, strength, 0.1f);
+        increment_col(base_pos, ui_state);
+        blit_string(base_pos, "Strength", ui_state, output, ui_state.text_col);
+        increment_row(base_pos, ui_state);
+
+        float_selector(base_pos, output, ui_state, radius, 2.0f);
+        increment_col(base_pos, ui_state);
+        blit_string(base_pos, "Radius", ui_state, output, ui_state.text_col);
+        increment_row(base_pos, ui_state);
+
+        strength = std::max(strength, 0.0f);
+        radius = std::min(std::max(radius, 4.0f), 64.0f);
+    }
+
+    void reset_settings() override
+    {
+        radius = 16.0f;
+        strength = 2.0f;
+        quarter_resolution = false;
+    }
+};
+
+/*
+ * Post process anti-aliasing in the style of FXAA. Pixels whose neighbours differ in
+ * luma by less than the threshold are copied, which is most of the frame. At an edge,
+ * the edge is followed along the frame in both directions to find where it ends, and
+ * the pixel is blended with its neighbour across the edge by how close it sits to the
+ * nearer end, softening the stair steps. Single pixel details are blended by how much
+ * they stand out from the pixels around them. The cost per pixel is bounded by the
+ * search length, however many triangles were drawn.
+ *
+ * Luma is 0 - 255 in 16 bit lanes, so the edge tests and the search give the same
+ * results with and without SSE.
+ */
+static const int fxaa_search_steps = 8;
+
+//contrast below which a pixel is never an edge, whatever the threshold
+static const int fxaa_min_contrast = 8;
+
+static void fxaa_luma_row(const rgba* pixels, short* out, const int width)
+{
+    auto x = 0;
+
+#if USE_SSE2
+    const auto byte_mask = _mm_set1_epi32(0xff);
+    const auto r_weight = _mm_set1_epi32(77);
+    const auto g_weight = _mm_set1_epi32(150);
+    const auto b_weight = _mm_set1_epi32(29);
+
+    //products fit the low 16 bits of each lane, the high halves multiply zero
+    const auto weigh = [&](const __m128i packed) {
+        const auto r = _mm_mullo_epi16(_mm_and_si128(packed, byte_mask), r_weight);
+        const auto g = _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(packed, 8), byte_mask), g_weight);
+        const auto b = _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(packed, 16), byte_mask), b_weight);
+
+        return _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(r, g), b), 8);
+    };
+
+    for (; x + 8 <= width; x += 8)
+    {
+        const auto lo = weigh(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + x)));
+        const auto hi = weigh(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + x + 4)));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_packs_epi32(lo, hi));
+    }
+#endif
+
+    for (; x < width; x++)
+    {
+        out[x] = static_cast<short>((77 * pixels[x].r + 150 * pixels[x].g + 29 * pixels[x].b) >> 8);
+    }
+}
+
+//relative is the threshold in 1/256ths of the brightest luma of the cross
+inline bool fxaa_is_edge(const int m, const int n, const int s, const int w, const int e, const int relative)
+{
+    const auto high = std::max(std::max(std::max(m, n), std::max(s, w)), e);
+    const auto low = std::min(std::min(std::min(m, n), std::min(s, w)), e);
+    const auto range = high - low;
+
+    return range >= fxaa_min_contrast && (range << 8) >= high * relative;
+}
+
+//index of the lowest set bit of a non zero 8 bit mask, without branching on it
+inline int lowest_set_bit(const int mask)
+{
+    const auto lowest = mask & -mask;
+
+    return ((lowest & 0xf0) != 0) << 2 | ((lowest & 0xcc) != 0) << 1 | ((lowest & 0xaa) != 0);
+}
+
+/*
+ * Bit i set when pixel x + i of the centre row is an edge, for i below count (at most 8).
+ * Columns past the frame are clamped.
+ */
+static int fxaa_edge_mask(
+    const short* above, const short* centre, const short* below,
+    const int x, const int count, const int width, const int relative
+){
+#if USE_SSE2
+    if (count == 8 && x >= 1 && x + 9 <= width)
+    {
+        const auto load = [](const short* src) {
+            return _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        };
+
+        const auto m = load(centre + x);
+        const auto n = load(above + x), s = load(below + x);
+        const auto w = load(centre + x - 1), e = load(centre + x + 1);
+
+        const auto high = _mm_max_epi16(_mm_max_epi16(_mm_max_epi16(m, n), _mm_max_epi16(s, w)), e);
+        const auto low = _mm_min_epi16(_mm_min_epi16(_mm_min_epi16(m, n), _mm_min_epi16(s, w)), e);
+        const auto range = _mm_sub_epi16(high, low);
+
+        //both sides are at most 255 * 256, compare them unsigned by saturating
+        const auto contrast = _mm_cmpgt_epi16(range, _mm_set1_epi16(fxaa_min_contrast - 1));
+        const auto relative_contrast = _mm_cmpeq_epi16(
+            _mm_subs_epu16(_mm_mullo_epi16(high, _mm_set1_epi16(static_cast<short>(relative))), _mm_slli_epi16(range, 8)),
+            _mm_setzero_si128()
+        );
+
+        return _mm_movemask_epi8(_mm_packs_epi16(_mm_and_si128(contrast, relative_contrast), _mm_setzero_si128()));
+    }
+#endif
+
+    auto mask = 0;
+    for (auto i = 0; i < count; i++)
+    {
+        const auto cx = x + i;
+        const auto left = std::max(cx - 1, 0);
+        const auto right = std::min(cx + 1, width - 1);
+
+        if (fxaa_is_edge(centre[cx], above[cx], below[cx], centre[left], centre[right], relative)) mask |= 1 << i;
+    }
+
+    return mask;
+}
+
+/*
+ * Steps along an edge in the luma plane, step i at along[i * stride], with the pixel
+ * across the edge at side_offset from it. Returns the first step where the sum of the
+ * two moves a quarter of the gradient away from local_sum, the pixel and its neighbour
+ * across the edge, or the last step if the edge runs past the search. All steps are
+ * tested at once, one 16 bit lane each.
+ */
+static int fxaa_edge_end(const short* along, const int stride, const int side_offset, const int local_sum, const int gradient)
+{
+    auto ended = 0;
+
+#if USE_SSE2
+    const auto steps = [stride](const short* first) {
+        if (stride == 1) return _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+
+        if (stride == -1)
+        {
+            const auto backwards = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(first - 7)), _MM_SHUFFLE(0, 1, 2, 3));
+            return _mm_shufflehi_epi16(_mm_shufflelo_epi16(backwards, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+        }
+
+        return _mm_setr_epi16(
+            first[0], first[stride], first[2 * stride], first[3 * stride],
+            first[4 * stride], first[5 * stride], first[6 * stride], first[7 * stride]
+        );
+    };
+
+    const auto zero = _mm_setzero_si128();
+    const auto sum = _mm_sub_epi16(
+        _mm_add_epi16(steps(along), steps(along + side_offset)),
+        _mm_set1_epi16(static_cast<short>(local_sum))
+    );
+    const auto magnitude = _mm_max_epi16(sum, _mm_sub_epi16(zero, sum));
+    const auto past = _mm_cmpgt_epi16(_mm_add_epi16(magnitude, magnitude), _mm_set1_epi16(static_cast<short>(gradient - 1)));
+
+    ended = _mm_movemask_epi8(_mm_packs_epi16(past, zero));
+#else
+    for (auto i = 0; i < fxaa_search_steps; i++)
+    {
+        if (2 * abs(along[i * stride] + along[i * stride + side_offset] - local_sum) >= gradient) ended |= 1 << i;
+    }
+#endif
+
+    //the last step when none of them end it
+    return lowest_set_bit(ended | 1 << (fxaa_search_steps - 1));
+}
+
+//per band luma of the tile and the pixels the edge search reaches, one per thread
+static thread_local std::vector<short> fxaa_luma;
+
+struct fxaa final : public screen_space_effect
+{
+    //contrast that counts as an edge, relative to the brightest pixel around it
+    float threshold = 0.125f;
+
+    //how strongly single pixel details are blended, 0 turns it off
+    float subpixel = 0.75f;
+
+    const char* name() override { return "Anti-Aliasing"; }
+
+    int footprint_rows() override { return fxaa_search_steps; }
+
+    //only pixels next to a contrasting pixel change, and the clear color is flat. One
+    //more for wireframe lines, which can fall just outside the triangles they outline
+    int coverage_margin() override { return 2; }
+
+    void apply_tile(const effect_tile& tile) override
+    {
+        const auto width = tile.input.width;
+        const auto height = tile.input.height;
+
+        //luma of every pixel the tile's edge searches can reach, addressed by frame column
+        const auto plane_min = std::max(tile.y_min - fxaa_search_steps, 0);
+        const auto plane_max = std::min(tile.y_max + fxaa_search_steps, height);
+        const auto plane_x_min = std::max(tile.x_min - fxaa_search_steps, 0);
+        const auto plane_x_max = std::min(tile.x_max + fxaa_search_steps, width);
+
+        if (static_cast<int>(fxaa_luma.size()) < (plane_max - plane_min) * width) fxaa_luma.resize((plane_max - plane_min) * width);
+
+        for (auto y = plane_min; y < plane_max; y++) {
+            auto* plane_row = fxaa_luma.data() + (y - plane_min) * width;
+            fxaa_luma_row(tile.input.row(y) + plane_x_min, plane_row + plane_x_min, plane_x_max - plane_x_min);
+        }
+
+        const auto luma_row = [&](const int y) {
+            return fxaa_luma.data() + (clamp(y, 0, height - 1) - plane_min) * width;
+        };
+
+        //the last step of a search is fxaa_search_steps along the edge, and the pixels
+        //across the edge are only a row or column away, so that is as far as smooth reads
+        const auto reach = fxaa_search_steps;
+        const auto window_size = 2 * reach + 1;
+
+        //luma the search reaches from pixels near the frame's edges, clamped to the frame
+        short window[window_size * window_size];
+
+        const auto relative = static_cast<int>(threshold * 256.0f + 0.5f);
+
+        //blends an edge pixel with its neighbour across the edge, from the luma around it
+        const auto smooth = [&](const int x, const int y, const short* centre, const int pitch) {
+            const auto luma = [centre, pitch](const int dx, const int dy) -> int {
+                return centre[dy * pitch + dx];
+            };
+
+            const auto m = luma(0, 0);
+            const auto n = luma(0, -1), s = luma(0, 1);
+            const auto w = luma(-1, 0), e = luma(1, 0);
+            const auto nw = luma(-1, -1), ne = luma(1, -1);
+            const auto sw = luma(-1, 1), se = luma(1, 1);
+
+            const auto high = std::max(std::max(std::max(m, n), std::max(s, w)), e);
+            const auto low = std::min(std::min(std::min(m, n), std::min(s, w)), e);
+            const auto range = high - low;
+
+            //a horizontal edge changes most from row to row
+            const auto change_vertically = abs(nw + sw - 2 * w) + 2 * abs(n + s - 2 * m) + abs(ne + se - 2 * e);
+            const auto change_horizontally = abs(nw + ne - 2 * n) + 2 * abs(w + e - 2 * m) + abs(sw + se - 2 * s);
+            const auto horizontal = change_vertically >= change_horizontally;
+
+            //blend towards the side of the edge that differs the most
+            const auto before = horizontal ? n : w;
+            const auto after = horizontal ? s : e;
+            const auto towards_before = abs(before - m) >= abs(after - m);
+            const auto side_step = towards_before ? -1 : 1;
+            const auto gradient = std::max(abs(before - m), abs(after - m));
+            const auto local_sum = m + (towards_before ? before : after);
+
+            //search half a pixel across the edge, so each step sees both sides of it
+            const auto side_x = horizontal ? 0 : side_step;
+            const auto side_y = horizontal ? side_step : 0;
+            const auto step_x = horizontal ? 1 : 0;
+            const auto step_y = horizontal ? 0 : 1;
+
+            const auto stride = step_y * pitch + step_x;
+            const auto side_offset = side_y * pitch + side_x;
+            int distance[2], end[2];
+
+            for (auto d = 0; d < 2; d++)
+            {
+                const auto direction = d == 0 ? -stride : stride;
+                const auto* along = centre + direction;
+
+                const auto step = fxaa_edge_end(along, direction, side_offset, local_sum, gradient);
+                distance[d] = step + 1;
+                end[d] = along[step * direction] + along[step * direction + side_offset] - local_sum;
+            }
+
+            //only the end the pixel is nearest to says which way the stair steps go
+            const auto nearer = distance[0] < distance[1] ? 0 : 1;
+            const auto m_is_darker = 2 * m < local_sum;
+            const auto edge_blend = (end[nearer] < 0) != m_is_darker ?
+                0.5f - static_cast<float>(distance[nearer]) / static_cast<float>(distance[0] + distance[1]) : 0.0f;
+
+            //single pixel details, by how far they stand out from the 3x3 around them
+            const auto average = static_cast<float>(2 * (n + s + w + e) + nw + ne + sw + se) / 12.0f;
+            const auto contrast = std::min(fabsf(average - static_cast<float>(m)) / static_cast<float>(range), 1.0f);
+            const auto smoothed = (3.0f - 2.0f * contrast) * contrast * contrast;
+            const auto detail_blend = smoothed * smoothed * subpixel;
+
+            const auto weight = static_cast<int>(std::max(edge_blend, detail_blend) * 256.0f + 0.5f);
+
+            const auto& pixel = tile.input.row(y)[x];
+            const auto& across = tile.input.row(clamp(y + side_y, 0, height - 1))[clamp(x + side_x, 0, width - 1)];
+
+            rgba out;
+            for (auto i = 0; i < 4; i++)
+            {
+                out.e[i] = static_cast<unsigned char>((pixel.e[i] * (256 - weight) + across.e[i] * weight + 128) >> 8);
+            }
+
+            return out;
+        };
+
+        for (auto y = tile.y_min; y < tile.y_max; y++) {
+            const auto* in = tile.input.row(y);
+            auto* out = tile.output.row(y);
+
+            const auto* above = luma_row(y - 1);
+            const auto* centre = luma_row(y);
+            const auto* below = luma_row(y + 1);
+
+            const auto direct_rows = y >= reach && y < height - reach;
+
+            for (auto x = tile.x_min; x < tile.x_max; x += 8) {
+                const auto count = std::min(8, tile.x_max - x);
+                auto edges = fxaa_edge_mask(above, centre, below, x, count, width, relative);
+
+                //most pixels aren't on an edge and are left as they are
+                memcpy(out + x, in + x, count * sizeof(rgba));
+
+                for (; edges != 0; edges &= edges - 1) {
+                    const auto px = x + lowest_set_bit(edges);
+
+                    if (direct_rows && px >= reach && px < width - reach) {
+                        out[px] = smooth(px, y, centre + px, width);
+                    }
+                    else {
+                        for (auto wy = 0; wy < window_size; wy++) {
+                            const auto* row = luma_row(y + wy - reach);
+
+                            for (auto wx = 0; wx < window_size; wx++) {
+                                window[wy * window_size + wx] = row[clamp(px + wx - reach, 0, width - 1)];
+                            }
+                        }
+
+                        out[px] = smooth(px, y, window + reach * window_size + reach, window_size);
+                    }
+                }
+            }
+        }
+    }
+
+    void render_ui(v2_i& base_pos, ui_state& ui_state, output_buffers& output) override
+    {
+        float_selector(base_pos, output, ui_state, threshold, 0.025f);
+        increment_col(base_pos, ui_state);
+        blit_string(base_pos, "Threshold", ui_state, output, ui_state.text_col);
+        increment_row(base_pos, ui_state);
+
+        float_selector(base_pos, output, ui_state, subpixel, 0.25f);
+        increment_col(base_pos, ui_state);
+        blit_string(base_pos, "Subpixel", ui_state, output, ui_state.text_col);
+        increment_row(base_pos, ui_state);
+
+        threshold = std::min(std::max(threshold, 0.025f), 0.5f);
+        subpixel = std::min(std::max(subpixel, 0.0f), 1.0f);
+    }
+
+    void reset_settings() override
+    {
+        threshold = 0.125f;
+        subpixel = 0.75f;
+    }
+};
@@ -0,0 +1,129 @@
+#include <cassert>
+
+#include "shading_rate.h"
+#include "render.h"
+
+const char* shading_rate_mode_name(const shading_rate_mode mode)
+{
+    switch (mode)
+    {
+    case shading_rate_mode::off: return "Off";
+    case shading_rate_mode::adaptive: return "Adaptive";
+    case shading_rate_mode::fixed_2x2: return "Fixed 2x2";
+    case shading_rate_mode::fixed_4x4: return "Fixed 4x4";
+    }
+
+    return "";
+}
+
+inline v2_i shading_rate_block_size(const shading_rate rate)
+{
+    switch (rate)
+    {
+    case shading_rate::rate_2x1: return { 2, 1 };
+    case shading_rate::rate_2x2: return { 2, 2 };
+    case shading_rate::rate_4x4: return { 4, 4 };
+    case shading_rate::rate_1x1:
+    default: return { 1, 1 };
+    }
+}
+
+static void resize_shading_rates(shading_rate_image& image, const int width, const int height)
+{
+    const auto tiles_x = (width + shading_rate_tile_size - 1) / shading_rate_tile_size;
+    const auto tiles_y = (height + shading_rate_tile_size - 1) / shading_rate_tile_size;
+
+    if (image.tiles_x == tiles_x && image.tiles_y == tiles_y) return;
+
+    delete[] image.rates;
+    delete[] image.block_cache;
+
+    image.tiles_x = tiles_x;
+    image.tiles_y = tiles_y;
+    image.rates = new shading_rate[tiles_x * tiles_y];
+    image.block_cache = new shading_rate_cache_entry[tiles_x * shading_rate_tile_size];
+    assert(image.rates != nullptr);
+    assert(image.block_cache != nullptr);
+
+    for (auto i = 0; i < tiles_x * tiles_y; i++)
+    {
+        image.rates[i] = shading_rate::rate_1x1;
+    }
+}
+
+/*
+ * Adaptive rates come from the luminance variance of a 4x4 grid of samples per tile,
+ * spaced 4 pixels apart. Coarse shading never changes pixels 4 apart to the same value,
+ * so the measurement is not biased by the rate the tile was rendered at last frame.
+ *
+ * Thresholds are on variance of 0-255 luminance.
+ */
+static shading_rate rate_from_variance(const int variance)
+{
+    if (variance < 4) return shading_rate::rate_4x4;
+    if (variance < 16) return shading_rate::rate_2x2;
+    if (variance < 64) return shading_rate::rate_2x1;
+
+    return shading_rate::rate_1x1;
+}
+
+void update_shading_rates(render_state& state)
+{
+    auto& image = state.shading_rates;
+    const auto& frame_buffer = state.output_buffers.frame_buffer;
+
+    if (image.mode == shading_rate_mode::off) return;
+
+    resize_shading_rates(image, frame_buffer.width, frame_buffer.height);
+
+    const auto tile_count = image.tiles_x * image.tiles_y;
+
+    if (image.mode == shading_rate_mode::fixed_2x2 || image.mode == shading_rate_mode::fixed_4x4)
+    {
+        const auto rate = image.mode == shading_rate_mode::fixed_2x2 ? shading_rate::rate_2x2 : shading_rate::rate_4x4;
+
+        for (auto i = 0; i < tile_count; i++)
+        {
+            image.rates[i] = rate;
+        }
+
+        return;
+    }
+
+    const auto pixels = make_image_view(frame_buffer);
+
+    for (auto tile_y = 0; tile_y < image.tiles_y; tile_y++)
+    {
+        for (auto tile_x = 0; tile_x < image.tiles_x; tile_x++)
+        {
+            auto sum = 0;
+            auto sum_sq = 0;
+            auto count = 0;
+
+            for (auto sample_y = 2; sample_y < shading_rate_tile_size; sample_y += 4)
+            {
+                const auto y = tile_y * shading_rate_tile_size + sample_y;
+                if (y >= frame_buffer.height) break;
+
+                const auto* row = pixels.row(y);
+
+                for (auto sample_x = 2; sample_x < shading_rate_tile_size; sample_x += 4)
+                {
+                    const auto x = tile_x * shading_rate_tile_size + sample_x;
+                    if (x >= frame_buffer.width) break;
+
+                    const auto& pixel = row[x];
+                    const auto luma = (pixel.r * 77 + pixel.g * 150 + pixel.b * 29) >> 8;
+
+                    sum += luma;
+                    sum_sq += luma * luma;
+                    count++;
+                }
+            }
+
+            const auto variance = count > 0 ? (sum_sq - sum * sum / count) / count : 0;
+
+            image.rates[tile_y * image.tiles_x + tile_x] = rate_from_variance(variance);
+        }
+    }
+}
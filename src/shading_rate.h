@@ -0,0 +1,69 @@
+#ifndef SHADING_RATE_H
+#define SHADING_RATE_H
+
+#include "maths.h"
+#include "image.h"
+
+/*
+ * Variable rate shading.
+ *
+ * The screen is split into 16x16 pixel tiles, each with a shading rate. At coarse
+ * rates the rasterizer runs the fragment shader once per block of pixels (2x1, 2x2
+ * or 4x4) and copies the result to every covered pixel of the block. Coverage and
+ * depth testing still happen per pixel, so silhouettes and occlusion stay sharp.
+ */
+enum class shading_rate : unsigned char
+{
+    rate_1x1,
+    rate_2x1,
+    rate_2x2,
+    rate_4x4,
+};
+
+/*
+ * How tile shading rates are picked.
+ *
+ *  off      - shade every pixel.
+ *  adaptive - per tile from the luminance variance of the previous frame.
+ *  fixed_*  - the same rate everywhere, useful for comparing quality.
+ */
+enum class shading_rate_mode
+{
+    off,
+    adaptive,
+    fixed_2x2,
+    fixed_4x4,
+};
+
+static const int shading_rate_mode_count = 4;
+static const int shading_rate_tile_size = 16;
+
+//color shaded for a sub-block, re-used by the rest of its pixels
+struct shading_rate_cache_entry
+{
+    int stamp;
+    rgba col;
+    bool visible;
+};
+
+struct shading_rate_image
+{
+    shading_rate_mode mode = shading_rate_mode::off;
+
+    int tiles_x{};
+    int tiles_y{};
+    shading_rate* rates{};
+
+    //one entry per screen column, used by the rasterizer
+    shading_rate_cache_entry* block_cache{};
+};
+
+const char* shading_rate_mode_name(shading_rate_mode mode);
+inline v2_i shading_rate_block_size(shading_rate rate);
+
+struct render_state;
+
+//picks tile rates for the next frame from the frame just rendered
+void update_shading_rates(render_state& state);
+
+#endif
@@ -0,0 +1,189 @@
+#include <cstring>
+
+#include "shadow.h"
+#include "file.h"
+#include "simd.h"
+
+/*
+ * Depth only shader used to render the shadow map. Fragments are never run, as the
+ * light space render state rasterizes with depth_only set.
+ */
+struct shadow_depth_shader final : public shader
+{
+    m4 light_model_view_proj{};
+
+    const char* name() override { return "Shadow Depth"; }
+    bool uses_lights() override { return false; }
+
+    void begin_pass() override
+    {
+        light_model_view_proj = renderer_state->projection * renderer_state->model_view;
+    }
+
+    v4 vertex(v3& vertex, int face_no, int vert_no) override
+    {
+        return light_model_view_proj * project_4d(vertex);
+    }
+
+    bool fragment(const v3& bar, rgba& col, v3 interpolated_normal, v2 interpolated_uv, const v2_i& screen_pos) override
+    {
+        return false;
+    }
+
+    void render_ui(v2_i& base_pos, ui_state& ui_state, output_buffers& output) override
+    {
+    }
+};
+
+static shadow_depth_shader shadow_depth_shader;
+
+void init_shadow_map(shadow_map& shadows, const int size)
+{
+    shadows.size = size;
+
+    //depth only, so the frame buffer has dimensions but no pixel data
+    auto& buffers = shadows.light_state.output_buffers;
+    buffers.frame_buffer.width = size;
+    buffers.frame_buffer.height = size;
+
+    buffers.z_buffer = new float[size * size];
+    assert(buffers.z_buffer != nullptr);
+
+    //render back faces too, the closest surface to the light is what matters
+    shadows.light_state.backspace_culling = false;
+    shadows.light_state.smooth_shading = false;
+    shadows.light_state.viewport = view_port(0, 0, static_cast<float>(size), static_cast<float>(size));
+
+    shadows.valid = false;
+}
+
+static float model_bounding_radius(const model& obj)
+{
+    auto radius_sq = 0.0f;
+
+    for (size_t i = 0; i < obj.mesh_count; i++)
+    {
+        const auto& mesh = obj.meshes[i];
+
+        for (size_t v = 0; v < mesh.vert_count; v++)
+        {
+            auto vert = mesh.verts[v];
+            const auto length_sq = vert.inner(vert);
+
+            if (length_sq > radius_sq) radius_sq = length_sq;
+        }
+    }
+
+    return radius_sq > 0 ? sqrtf(radius_sq) : 1.0f;
+}
+
+void update_shadow_map(shadow_map& shadows, model& obj, const render_state& state)
+{
+    const auto up_to_date =
+        shadows.valid &&
+        shadows.cached_model == &obj &&
+        memcmp(&shadows.cached_model_matrix, &state.model_matrix, sizeof(m4)) == 0 &&
+        memcmp(&shadows.cached_light_dir, &state.light_dir, sizeof(v3)) == 0;
+
+    shadows.rebuilt_last_update = !up_to_date;
+
+    if (up_to_date) return;
+
+    if (shadows.cached_model != &obj || !shadows.valid)
+    {
+        shadows.cached_model_radius = model_bounding_radius(obj);
+    }
+
+    auto& light_state = shadows.light_state;
+
+    //orthographic projection looking down the light direction, fitted to the model's bounding sphere
+    auto light_dir = state.light_dir;
+    const auto up = std::abs(light_dir.normalise().y) > 0.99f ? v3{ 1, 0, 0 } : v3{ 0, 1, 0 };
+    const auto inv_radius = 1.0f / shadows.cached_model_radius;
+
+    light_state.eye = light_dir;
+    light_state.center = v3{ 0, 0, 0 };
+    light_state.up = up;
+    light_state.model_view = look_at(light_state.eye, light_state.center, up) * state.model_matrix;
+    light_state.projection = scale(v3{ inv_radius, inv_radius, inv_radius });
+
+    shadows.light_model_view_proj = light_state.projection * light_state.model_view;
+
+    auto* z_buffer = light_state.output_buffers.z_buffer;
+    for (auto i = 0; i < shadows.size * shadows.size; i++)
+    {
+        z_buffer[i] = min_z_buffer_val;
+    }
+
+    light_state.depth_only = true;
+    draw_model(obj, light_state, shadow_depth_shader);
+    light_state.depth_only = false;
+
+    shadows.cached_model = &obj;
+    shadows.cached_model_matrix = state.model_matrix;
+    shadows.cached_light_dir = state.light_dir;
+    shadows.valid = true;
+}
+
+inline v3 object_to_shadow_space(const shadow_map& shadows, const v3& vertex)
+{
+    const auto clip = shadows.light_model_view_proj * project_4d(vertex);
+    const auto half_size = static_cast<float>(shadows.size) * 0.5f;
+
+    //same mapping as the light state's viewport, keeping z as the rasterizer stores it
+    return {
+        clip.x * half_size + half_size,
+        clip.y * half_size + half_size,
+        clip.z
+    };
+}
+
+inline float sample_shadow_pcf(const shadow_map& shadows, const v3& shadow_pos)
+{
+    const auto size = shadows.size;
+    const auto* z_buffer = shadows.light_state.output_buffers.z_buffer;
+
+    const auto x = static_cast<int>(floorf(shadow_pos.x + 0.5f));
+    const auto y = static_cast<int>(floorf(shadow_pos.y + 0.5f));
+
+    //outside of the map, nothing can be casting a shadow
+    if (x < 0 || y < 0 || x >= size || y >= size) return 1.0f;
+
+    //lit if the surface is at least as close to the light as the stored depth
+    const auto reference = shadow_pos.z + shadows.bias;
+    auto lit = 0;
+
+#if USE_SSE2
+    //interior texels, compare a row of four depths at once and keep the three we need
+    if (x >= 1 && x + 2 < size && y >= 1 && y + 1 < size)
+    {
+        static const int lit_counts[8] = { 0, 1, 1, 2, 1, 2, 2, 3 };
+        const auto reference_4 = _mm_set1_ps(reference);
+
+        for (auto dy = -1; dy <= 1; dy++)
+        {
+            const auto* row = z_buffer + (size - 1 - (y + dy)) * size + x - 1;
+            const auto mask = _mm_movemask_ps(_mm_cmpge_ps(reference_4, _mm_loadu_ps(row)));
+
+            lit += lit_counts[mask & 7];
+        }
+
+        return static_cast<float>(lit) * (1.0f / 9.0f);
+    }
+#endif
+
+    for (auto dy = -1; dy <= 1; dy++)
+    {
+        const auto sample_y = std::min(std::max(y + dy, 0), size - 1);
+        const auto* row = z_buffer + (size - 1 - sample_y) * size;
+
+        for (auto dx = -1; dx <= 1; dx++)
+        {
+            const auto sample_x = std::min(std::max(x + dx, 0), size - 1);
+
+            if (reference >= row[sample_x]) lit++;
+        }
+    }
+
+    return static_cast<float>(lit) * (1.0f / 9.0f);
+}
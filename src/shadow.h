@@ -0,0 +1,52 @@
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include "render.h"
+
+struct model;
+
+/*
+ * Directional shadow map for render_state::light_dir.
+ *
+ * The map is a depth-only render of the model from the light's point of view, made
+ * by running the normal rasterizer against a light space render_state. Since the map
+ * lives in light space it only needs re-rendering when the light direction, the model,
+ * or the model transform change; camera movement alone re-uses the cached map.
+ *
+ * light_dir is treated as a world space direction. This app's camera looks down the
+ * z axis without rotation, so world and view space directions line up.
+ */
+struct shadow_map
+{
+    //light space render state, its z buffer is the shadow map
+    render_state light_state;
+    int size{};
+
+    //object space to shadow map space (x, y in texels, z as stored in the z buffer)
+    m4 light_model_view_proj{};
+
+    //depth offset that keeps surfaces from shadowing themselves
+    float bias = 0.02f;
+
+    //cache key, the map is re-rendered when any of these change
+    const model* cached_model{};
+    m4 cached_model_matrix{};
+    v3 cached_light_dir{};
+    float cached_model_radius{};
+    bool valid{};
+
+    //true if the last update re-rendered the map
+    bool rebuilt_last_update{};
+};
+
+void init_shadow_map(shadow_map& shadows, int size);
+
+//re-renders the shadow map if the light or model transform changed since the last call
+void update_shadow_map(shadow_map& shadows, model& obj, const render_state& state);
+
+inline v3 object_to_shadow_space(const shadow_map& shadows, const v3& vertex);
+
+//fraction of 3x3 shadow map texels around the position that are lit (0 - fully shadowed, 1 - fully lit)
+inline float sample_shadow_pcf(const shadow_map& shadows, const v3& shadow_pos);
+
+#endif
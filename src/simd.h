@@ -0,0 +1,16 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+/*
+ * SSE2 is available on every x86-64 desktop target, and emscripten translates
+ * it to wasm simd128 when building with "-msimd128 -msse2". Code using these
+ * intrinsics must still provide a scalar path for targets without them.
+ */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2 1
+#include <emmintrin.h>
+#else
+#define USE_SSE2 0
+#endif
+
+#endif
@@ -0,0 +1,466 @@
+#include <cmath>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+#include "texture.h"
+
+inline int texture::width() const
+{
+    return levels[0].width;
+}
+
+inline int texture::height() const
+{
+    return levels[0].height;
+}
+
+bool load_texture(const char* path, texture& out, const texture_layout layout, const texture_format format)
+{
+    image loaded{};
+    if (!load_image(path, loaded))
+    {
+        return false;
+    }
+
+    //move the pixels out of stb_image's allocation, so every level can be freed the same way
+    auto& base = out.levels[0];
+    base = loaded;
+    base.data = new unsigned char[loaded.width * loaded.height * loaded.n_channels];
+    assert(base.data != nullptr);
+    memcpy(base.data, loaded.data, loaded.width * loaded.height * loaded.n_channels);
+    stbi_image_free(loaded.data);
+
+    out.level_count = 1;
+    out.layout = texture_layout::linear;
+    out.format = texture_format::rgba8;
+    build_mip_chain(out);
+
+    convert_texture_format(out, format);
+    convert_texture_layout(out, layout);
+
+    return true;
+}
+
+/*
+ * Each level is a 2x2 box filter of the level above it. When the level above has
+ * an odd width or height, the last row/column is clamped rather than averaged
+ * with pixels from outside the image.
+ */
+void build_mip_chain(texture& tex)
+{
+    assert(tex.level_count >= 1);
+    assert(tex.levels[0].n_channels == 4);
+    assert(tex.layout == texture_layout::linear);
+    assert(tex.format == texture_format::rgba8);
+
+    while (tex.level_count < max_mip_levels)
+    {
+        const auto& src = tex.levels[tex.level_count - 1];
+        if (src.width == 1 && src.height == 1) break;
+
+        auto& dst = tex.levels[tex.level_count];
+        dst.width = src.width > 1 ? src.width / 2 : 1;
+        dst.height = src.height > 1 ? src.height / 2 : 1;
+        dst.n_channels = 4;
+        dst.data = new unsigned char[dst.width * dst.height * 4];
+        assert(dst.data != nullptr);
+
+        const auto* src_pixels = reinterpret_cast<const rgba*>(src.data);
+        auto* dst_pixels = reinterpret_cast<rgba*>(dst.data);
+
+        for (auto y = 0; y < dst.height; y++)
+        {
+            const auto* row_a = src_pixels + std::min(y * 2, src.height - 1) * src.width;
+            const auto* row_b = src_pixels + std::min(y * 2 + 1, src.height - 1) * src.width;
+
+            for (auto x = 0; x < dst.width; x++)
+            {
+                const auto x0 = std::min(x * 2, src.width - 1);
+                const auto x1 = std::min(x * 2 + 1, src.width - 1);
+
+                auto& out = dst_pixels[y * dst.width + x];
+
+                for (auto c = 0; c < 4; c++)
+                {
+                    const auto sum = row_a[x0].e[c] + row_a[x1].e[c] + row_b[x0].e[c] + row_b[x1].e[c];
+                    out.e[c] = static_cast<unsigned char>((sum + 2) / 4);
+                }
+            }
+        }
+
+        tex.level_count++;
+    }
+}
+
+static int tiled_texel_index(const image& level, const int x, const int y)
+{
+    //coordinates are never negative, so tiles can be found with shifts and masks
+    const auto tiles_x = (level.width + texture_tile_size - 1) >> texture_tile_shift;
+    const auto tile_idx = (y >> texture_tile_shift) * tiles_x + (x >> texture_tile_shift);
+    const auto mask = texture_tile_size - 1;
+
+    return (tile_idx << (texture_tile_shift * 2)) + ((y & mask) << texture_tile_shift) + (x & mask);
+}
+
+static int tiled_level_size(const image& level)
+{
+    const auto tiles_x = (level.width + texture_tile_size - 1) / texture_tile_size;
+    const auto tiles_y = (level.height + texture_tile_size - 1) / texture_tile_size;
+
+    return tiles_x * tiles_y * texture_tile_size * texture_tile_size;
+}
+
+inline unsigned char encode_normal_component(const float value)
+{
+    const auto encoded = static_cast<int>((value * 0.5f + 0.5f) * 255.0f + 0.5f);
+
+    return static_cast<unsigned char>(encoded < 0 ? 0 : (encoded > 255 ? 255 : encoded));
+}
+
+/*
+ * Re-encodes every level of an rgba8 texture. For normal maps the box filtered mip
+ * levels hold shortened normals, so each texel is renormalised before x and y are
+ * stored. Tangent space normals always point out of the surface, so z is implied.
+ */
+void convert_texture_format(texture& tex, const texture_format format)
+{
+    if (tex.format == format) return;
+
+    assert(tex.format == texture_format::rgba8);
+    assert(tex.compression == texture_compression::none);
+    assert(tex.layout == texture_layout::linear);
+
+    for (auto i = 0; i < tex.level_count; i++)
+    {
+        auto& level = tex.levels[i];
+
+        const auto texel_count = level.width * level.height;
+        const auto* src = reinterpret_cast<const rgba*>(level.data);
+
+        auto* dst = new unsigned char[texel_count * 2];
+        assert(dst != nullptr);
+
+        for (auto t = 0; t < texel_count; t++)
+        {
+            v3 normal{
+                static_cast<float>(src[t].r) / 255.0f * 2.0f - 1.0f,
+                static_cast<float>(src[t].g) / 255.0f * 2.0f - 1.0f,
+                static_cast<float>(src[t].b) / 255.0f * 2.0f - 1.0f
+            };
+
+            const auto length = sqrtf(normal.inner(normal));
+            if (length > 1e-6f) normal = normal / length;
+
+            dst[t * 2] = encode_normal_component(normal.x);
+            dst[t * 2 + 1] = encode_normal_component(normal.y);
+        }
+
+        delete[] level.data;
+
+        level.data = dst;
+        level.n_channels = 2;
+    }
+
+    tex.format = format;
+}
+
+/*
+ * Packs the diffuse, normal and specular maps of a mesh into one material8 texture,
+ * level by level. Fails if the maps are in the wrong formats or their sizes differ.
+ */
+bool build_material_texture(texture& out, const texture& diffuse, const texture& normal, const texture& spec)
+{
+    if (diffuse.format != texture_format::rgba8 || normal.format != texture_format::normal_xy8 || spec.format != texture_format::rgba8) return false;
+    if (diffuse.compression != texture_compression::none || normal.compression != texture_compression::none || spec.compression != texture_compression::none) return false;
+    if (diffuse.level_count != normal.level_count || diffuse.level_count != spec.level_count) return false;
+    if (diffuse.width() != normal.width() || diffuse.height() != normal.height()) return false;
+    if (diffuse.width() != spec.width() || diffuse.height() != spec.height()) return false;
+
+    out.level_count = diffuse.level_count;
+    out.layout = texture_layout::linear;
+    out.format = texture_format::material8;
+
+    for (auto i = 0; i < out.level_count; i++)
+    {
+        auto& level = out.levels[i];
+        level.width = diffuse.levels[i].width;
+        level.height = diffuse.levels[i].height;
+        level.n_channels = 8;
+        level.data = new unsigned char[level.width * level.height * 8];
+        assert(level.data != nullptr);
+
+        for (auto y = 0; y < level.height; y++)
+        {
+            //output rows are top down, texel fetches are bottom up
+            const auto fetch_y = level.height - 1 - y;
+
+            for (auto x = 0; x < level.width; x++)
+            {
+                auto* record = level.data + (y * level.width + x) * 8;
+
+                const auto dif = get_texel(diffuse, i, x, fetch_y);
+                const auto normal_xy = get_normal_texel(normal, i, x, fetch_y);
+                const auto spec_texel = get_texel(spec, i, x, fetch_y);
+
+                memcpy(record, &dif, sizeof(dif));
+                memcpy(record + 4, &normal_xy, sizeof(normal_xy));
+                record[6] = spec_texel.b;
+                record[7] = 0;
+            }
+        }
+    }
+
+    convert_texture_layout(out, diffuse.layout);
+
+    return true;
+}
+
+void free_texture(texture& tex)
+{
+    for (auto i = 0; i < tex.level_count; i++)
+    {
+        delete[] tex.levels[i].data;
+        tex.levels[i] = image{};
+    }
+
+    tex.level_count = 0;
+    tex.compression = texture_compression::none;
+}
+
+size_t texture_memory_size(const texture& tex)
+{
+    size_t size = 0;
+
+    for (auto i = 0; i < tex.level_count; i++)
+    {
+        const auto& level = tex.levels[i];
+
+        if (tex.compression != texture_compression::none)
+        {
+            size += compressed_level_size(level, tex.compression);
+        }
+        else
+        {
+            const auto texel_count = tex.layout == texture_layout::tiled ? tiled_level_size(level) : level.width * level.height;
+            size += texel_count * level.n_channels;
+        }
+    }
+
+    return size;
+}
+
+/*
+ * Re-orders the texels of every level. Coordinates here are raw rows (top down),
+ * the same as the linear data, so the flip in get_texel is layout independent.
+ */
+void convert_texture_layout(texture& tex, const texture_layout layout)
+{
+    if (tex.layout == layout) return;
+
+    assert(tex.compression == texture_compression::none);
+
+    for (auto i = 0; i < tex.level_count; i++)
+    {
+        auto& level = tex.levels[i];
+
+        const auto texel_size = level.n_channels;
+        const auto* src = level.data;
+
+        const auto dst_size = layout == texture_layout::tiled ? tiled_level_size(level) : level.width * level.height;
+        auto* dst = new unsigned char[dst_size * texel_size]{};
+        assert(dst != nullptr);
+
+        for (auto y = 0; y < level.height; y++)
+        {
+            for (auto x = 0; x < level.width; x++)
+            {
+                const auto linear_idx = y * level.width + x;
+                const auto tiled_idx = tiled_texel_index(level, x, y);
+
+                if (layout == texture_layout::tiled)
+                {
+                    memcpy(dst + tiled_idx * texel_size, src + linear_idx * texel_size, texel_size);
+                }
+                else
+                {
+                    memcpy(dst + linear_idx * texel_size, src + tiled_idx * texel_size, texel_size);
+                }
+            }
+        }
+
+        delete[] level.data;
+
+        level.data = dst;
+    }
+
+    tex.layout = layout;
+}
+
+inline const unsigned char* texel_address(const texture& tex, const int level, const int x, int y)
+{
+    const auto& img = tex.levels[level];
+
+    //read from bottom up
+    y = img.height - y - 1;
+
+    assert(x >= 0 && x < img.width);
+    assert(y >= 0 && y < img.height);
+
+    if (tex.compression != texture_compression::none)
+    {
+        return decoded_block_texel(tex, level, x, y);
+    }
+
+    const auto idx = tex.layout == texture_layout::tiled ? tiled_texel_index(img, x, y) : y * img.width + x;
+
+    return img.data + idx * img.n_channels;
+}
+
+inline rgba get_texel(const texture& tex, const int level, const int x, const int y)
+{
+    assert(tex.format == texture_format::rgba8);
+
+    rgba col;
+    memcpy(&col, texel_address(tex, level, x, y), sizeof(col));
+    return col;
+}
+
+inline void get_material_texel(const texture& tex, const int level, const int x, const int y, unsigned char* out)
+{
+    assert(tex.format == texture_format::material8);
+
+    memcpy(out, texel_address(tex, level, x, y), 8);
+}
+
+inline unsigned short get_normal_texel(const texture& tex, const int level, const int x, const int y)
+{
+    assert(tex.format == texture_format::normal_xy8);
+
+    unsigned short packed;
+    memcpy(&packed, texel_address(tex, level, x, y), sizeof(packed));
+    return packed;
+}
+
+/*
+ * Fetches texels along straight lines through the texture in a few directions, once
+ * per layout, and prints the throughput. Lines start at pseudo random positions and
+ * wrap at the texture edges, the same lines are walked for every layout.
+ */
+void benchmark_texture_layouts(const texture& tex)
+{
+    struct direction
+    {
+        const char* name;
+        int step_x, step_y;
+    };
+
+    const direction directions[] = {
+        { "Horizontal", 1, 0 },
+        { "Vertical", 0, 1 },
+        { "Diagonal", 1, 1 },
+        { "Steep Diagonal", 1, 3 },
+    };
+
+    const texture_layout layouts[] = { texture_layout::linear, texture_layout::tiled };
+    const char* layout_names[] = { "Linear", "Tiled 4x4" };
+    const auto layout_count = 2;
+
+    const auto line_count = 8192;
+    const auto line_length = 256;
+    const auto width = tex.width();
+    const auto height = tex.height();
+
+    //single level copies of the full resolution image in each layout
+    texture copies[layout_count]{};
+
+    for (auto i = 0; i < layout_count; i++)
+    {
+        auto& level = copies[i].levels[0];
+        level = tex.levels[0];
+
+        const auto texel_size = level.n_channels;
+        const auto size = layouts[i] == texture_layout::tiled ? tiled_level_size(level) : width * height;
+        auto* texels = new unsigned char[size * texel_size]{};
+        assert(texels != nullptr);
+
+        for (auto y = 0; y < height; y++)
+        {
+            for (auto x = 0; x < width; x++)
+            {
+                const auto idx = layouts[i] == texture_layout::tiled ? tiled_texel_index(level, x, y) : y * width + x;
+                memcpy(texels + idx * texel_size, texel_address(tex, 0, x, height - 1 - y), texel_size);
+            }
+        }
+
+        level.data = texels;
+        copies[i].level_count = 1;
+        copies[i].layout = layouts[i];
+        copies[i].format = tex.format;
+    }
+
+    printf("Texel fetch benchmark, %dx%d texture, %d fetches per test\n", width, height, line_count * line_length);
+
+    for (const auto& dir : directions)
+    {
+        for (auto i = 0; i < layout_count; i++)
+        {
+            unsigned int seed = 12345;
+            unsigned int checksum = 0;
+
+            const auto start = std::chrono::high_resolution_clock::now();
+
+            for (auto line = 0; line < line_count; line++)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                auto x = static_cast<int>((seed >> 8) % static_cast<unsigned int>(width));
+                seed = seed * 1664525u + 1013904223u;
+                auto y = static_cast<int>((seed >> 8) % static_cast<unsigned int>(height));
+
+                for (auto step = 0; step < line_length; step++)
+                {
+                    checksum += texel_address(copies[i], 0, x, y)[1];
+
+                    x += dir.step_x;
+                    y += dir.step_y;
+                    if (x >= width) x -= width;
+                    if (y >= height) y -= height;
+                }
+            }
+
+            const auto stop = std::chrono::high_resolution_clock::now();
+            const auto ms = std::chrono::duration<double, std::milli>(stop - start).count();
+            const auto mtexels_per_second = static_cast<double>(line_count) * line_length / (ms * 1000.0);
+
+            printf("  %-16s %-10s %8.2f ms %8.1f Mtexels/s (checksum %u)\n", dir.name, layout_names[i], ms, mtexels_per_second, checksum);
+        }
+    }
+
+    for (auto& copy : copies)
+    {
+        delete[] copy.levels[0].data;
+    }
+}
+
+/*
+ * Standard isotropic lod selection: the footprint of a pixel is the longer of the two
+ * derivative vectors measured in texels, and the lod is log2 of that length. Done on
+ * the squared length, so only a single log is needed.
+ */
+inline float texture_lod(const texture& tex, const v2& uv_dx, const v2& uv_dy)
+{
+    const auto width = static_cast<float>(tex.width());
+    const auto height = static_cast<float>(tex.height());
+
+    const auto dx_u = uv_dx.x * width, dx_v = uv_dx.y * height;
+    const auto dy_u = uv_dy.x * width, dy_v = uv_dy.y * height;
+
+    const auto footprint_sq = std::max(dx_u * dx_u + dx_v * dx_v, dy_u * dy_u + dy_v * dy_v);
+
+    //magnified
+    if (!(footprint_sq > 1.0f)) return 0;
+
+    return 0.5f * log2f(footprint_sq);
+}
@@ -0,0 +1,95 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include "maths.h"
+#include "image.h"
+#include "block_compression.h"
+
+static const int max_mip_levels = 16;
+
+/*
+ * Texel storage order of every level of a texture.
+ *
+ *  linear - rows of texels, top row first, as loaded.
+ *  tiled  - 4x4 blocks of texels, stored one after another in row order. An rgba8 block
+ *           is 64 bytes, one cache line, so fetches that move along v or along a
+ *           diagonal stay inside the same line far more often than with rows.
+ *           Levels whose size is not a multiple of 4 are padded out to whole tiles.
+ */
+enum class texture_layout
+{
+    linear,
+    tiled,
+};
+
+/*
+ * Texel encoding of every level of a texture.
+ *
+ *  rgba8      - 4 bytes per texel, as loaded.
+ *  normal_xy8 - 2 bytes per texel holding the x and y of a unit length tangent space
+ *               normal, z is rebuilt as sqrt(1 - x*x - y*y) when sampled. Half the
+ *               memory and fetch bandwidth of rgba8, and no per fetch renormalise.
+ *  material8  - 8 byte records interleaving a mesh's maps, so a lit pixel reads all of
+ *               them with a single fetch: diffuse rgba, normal x/y (as normal_xy8),
+ *               specular exponent, and a padding byte.
+ */
+enum class texture_format
+{
+    rgba8,
+    normal_xy8,
+    material8,
+};
+
+static const int texture_tile_shift = 2;
+static const int texture_tile_size = 1 << texture_tile_shift;
+
+/*
+ * A texture and its mip chain. levels[0] is the full resolution image, and each
+ * following level halves the width and height of the previous one, down to 1x1.
+ *
+ * Fragments pick a level from their screen space uv derivatives, so a model
+ * covering a few hundred pixels reads from a level of about the same size
+ * instead of jumping around the full resolution image.
+ */
+struct texture
+{
+    image levels[max_mip_levels];
+    int level_count{};
+
+    texture_layout layout = texture_layout::linear;
+    texture_format format = texture_format::rgba8;
+
+    //block compression of the texels, fetches still return texels in format
+    texture_compression compression = texture_compression::none;
+    unsigned int compressed_id{};
+
+    inline int width() const;
+    inline int height() const;
+};
+
+bool load_texture(const char* path, texture& out, texture_layout layout, texture_format format);
+void build_mip_chain(texture& tex);
+void convert_texture_layout(texture& tex, texture_layout layout);
+void convert_texture_format(texture& tex, texture_format format);
+bool build_material_texture(texture& out, const texture& diffuse, const texture& normal, const texture& spec);
+void free_texture(texture& tex);
+
+//bytes held by the texels of every level
+size_t texture_memory_size(const texture& tex);
+
+//compares texel fetch throughput of the layouts, walking the texture along different uv directions
+void benchmark_texture_layouts(const texture& tex);
+
+//mip level of detail for a fragment, from its uv derivatives along screen x and y
+inline float texture_lod(const texture& tex, const v2& uv_dx, const v2& uv_dy);
+
+//texel fetch that handles the texture's layout, y is bottom up like get_pixel
+inline rgba get_texel(const texture& tex, int level, int x, int y);
+
+//raw x/y bytes of a normal_xy8 texel, x in the low byte
+inline unsigned short get_normal_texel(const texture& tex, int level, int x, int y);
+
+//copies the 8 byte record of a material8 texel into out
+inline void get_material_texel(const texture& tex, int level, int x, int y, unsigned char* out);
+
+#endif
@@ -0,0 +1,56 @@
+#include <cassert>
+
+#include "texture_residency.h"
+
+void make_model_resident(texture_residency& residency, worker_pool& pool, model* models, const int model_count, const int model_idx)
+{
+    assert(model_idx >= 0 && model_idx < model_count);
+
+    auto& model = models[model_idx];
+
+    if (!model.textures_resident)
+    {
+        load_model_textures(model, pool);
+
+        model.texture_bytes = model_texture_memory_size(model);
+        residency.resident_bytes += model.texture_bytes;
+        residency.resident_models++;
+        residency.loads++;
+    }
+
+    model.last_used = ++residency.clock;
+
+    enforce_texture_budget(residency, models, model_count, model_idx);
+}
+
+void enforce_texture_budget(texture_residency& residency, model* models, const int model_count, const int keep_idx)
+{
+    const auto budget_bytes = static_cast<size_t>(residency.budget_mb) * 1024 * 1024;
+
+    while (residency.resident_bytes > budget_bytes)
+    {
+        //least recently used resident model
+        auto lru_idx = -1;
+
+        for (auto i = 0; i < model_count; i++)
+        {
+            if (i == keep_idx || !models[i].textures_resident) continue;
+
+            if (lru_idx == -1 || models[i].last_used < models[lru_idx].last_used)
+            {
+                lru_idx = i;
+            }
+        }
+
+        //only the kept model is left
+        if (lru_idx == -1) break;
+
+        auto& model = models[lru_idx];
+        free_model_textures(model);
+
+        residency.resident_bytes -= model.texture_bytes;
+        residency.resident_models--;
+        residency.evictions++;
+        model.texture_bytes = 0;
+    }
+}
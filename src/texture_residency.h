@@ -0,0 +1,34 @@
+#ifndef TEXTURE_RESIDENCY_H
+#define TEXTURE_RESIDENCY_H
+
+#include "file.h"
+
+/*
+ * Keeps the decoded textures of recently viewed models in memory, up to a budget.
+ *
+ * Models load with geometry only. A model's textures are decoded when it is selected,
+ * and models that are no longer active stay resident until the total goes over the
+ * budget, at which point the least recently selected ones are freed. The active model
+ * is never evicted, even when it alone is larger than the budget.
+ */
+struct texture_residency
+{
+    int budget_mb = 16;
+
+    size_t resident_bytes{};
+    int resident_models{};
+
+    //use counter, stamped onto models when they are selected
+    unsigned long long clock{};
+
+    int loads{};
+    int evictions{};
+};
+
+//decodes the model's textures if they are not resident, then evicts other models to fit the budget
+void make_model_resident(texture_residency& residency, worker_pool& pool, model* models, int model_count, int model_idx);
+
+//evicts least recently used models, other than keep_idx, until the resident textures fit the budget
+void enforce_texture_budget(texture_residency& residency, model* models, int model_count, int keep_idx);
+
+#endif
@@ -79,10 +79,13 @@ bool labeled_button(
 
 inline void draw_box(const v2_i& min, const v2_i& size, output_buffers& out, const rgba& col){
     const auto max = min + size;
+    const auto view = make_image_view(out.frame_buffer);
 
     for(auto y = min.y; y < max.y; y++){
+        auto* row = view.row(y);
+
         for(auto x = min.x; x < max.x; x++){
-            set_pixel(out.frame_buffer, col, x, y);
+            row[x] = col;
         }
     }
 }
@@ -151,21 +154,18 @@ static void blit_letter(v2_i btm_left, unsigned char letter, ui_state& ui_state,
     const auto y_max = y_min + cell_height;
 
     const auto x_min = (val % chars_per_row) * cell_width;
-    const auto x_max = x_min + cell_width;
 
-    const auto initial_x = btm_left.x;
+    const auto letters = make_image_view(ui_state.letter_sampler);
+    const auto view = make_image_view(out.frame_buffer);
 
     for(auto y = y_min; y < y_max; y++){
-        btm_left.x = initial_x;
-
-        for(auto x = x_min; x < x_max; x++){
-            const auto sample_color = get_pixel(ui_state.letter_sampler, x, y);
+        const auto* letter_row = letters.row(y) + x_min;
+        auto* row = view.row(btm_left.y) + btm_left.x;
 
-            if(sample_color.a > 0){
-                set_pixel(out.frame_buffer, color, btm_left.x, btm_left.y);
+        for(auto x = 0; x < cell_width; x++){
+            if(letter_row[x].a > 0){
+                row[x] = color;
             }
-
-            btm_left.x++;
         }
         btm_left.y++;
     }
@@ -41,7 +41,7 @@ inline void increment_row(v2_i& offset, const ui_state& state);
 inline void increment_col(v2_i& offset, const ui_state& state);
 
 void labeled_toggle(v2_i& ui_draw_position, ui_state& ui_state, output_buffers& output, const char* label, bool& state);
-void labeled_string(v2_i& ui_draw_position, ui_state& ui_state, output_buffers& output, char* label, const char* string);
+void labeled_string(v2_i& ui_draw_position, ui_state& ui_state, output_buffers& output, const char* label, const char* string);
 void left_right_selector(v2_i& ui_draw_position, ui_state& ui_state, output_buffers& output, const char* label, bool& left_clicked, bool& right_clicked);
 bool labeled_button(v2_i& ui_draw_position, ui_state& ui_state, output_buffers& output, const char* label);
 
@@ -0,0 +1,152 @@
+#include <cassert>
+
+#include "worker_pool.h"
+
+#if USE_THREADS
+
+//claims and runs jobs of the current batch until there are none left
+static void work_on_batch(worker_pool& pool, const job_function job, void* context, const int job_count)
+{
+    for (;;)
+    {
+        const auto job_idx = pool.next_job.fetch_add(1);
+        if (job_idx >= job_count) break;
+
+        job(context, job_idx);
+        pool.jobs_done.fetch_add(1);
+    }
+}
+
+static void worker_main(worker_pool* pool)
+{
+    unsigned seen_generation = 0;
+
+    for (;;)
+    {
+        job_function job;
+        void* context;
+        int job_count;
+
+        {
+            std::unique_lock<std::mutex> guard(pool->lock);
+            pool->batch_ready.wait(guard, [&] {
+                return pool->shutting_down || pool->generation != seen_generation;
+            });
+
+            if (pool->shutting_down) return;
+
+            seen_generation = pool->generation;
+            job = pool->job;
+            context = pool->context;
+            job_count = pool->job_count;
+
+            //the batch can't finish, and the next one can't start, while this thread is in it
+            pool->active_workers++;
+        }
+
+        work_on_batch(*pool, job, context, job_count);
+
+        {
+            std::lock_guard<std::mutex> guard(pool->lock);
+            pool->active_workers--;
+        }
+        pool->batch_done.notify_all();
+    }
+}
+
+#endif
+
+void init_worker_pool(worker_pool& pool, const int worker_count)
+{
+#if USE_THREADS
+    assert(pool.threads.empty());
+
+    pool.thread_count = worker_count;
+    pool.shutting_down = false;
+
+    for (auto i = 0; i < worker_count; i++)
+    {
+        pool.threads.emplace_back(worker_main, &pool);
+    }
+#else
+    //no threads to start, jobs run on the caller
+    pool.thread_count = 0;
+#endif
+}
+
+void shutdown_worker_pool(worker_pool& pool)
+{
+#if USE_THREADS
+    {
+        std::lock_guard<std::mutex> guard(pool.lock);
+        pool.shutting_down = true;
+    }
+    pool.batch_ready.notify_all();
+
+    for (auto& thread : pool.threads)
+    {
+        thread.join();
+    }
+
+    pool.threads.clear();
+#endif
+
+    pool.thread_count = 0;
+}
+
+int default_worker_count()
+{
+#if USE_THREADS
+    const auto hardware_threads = static_cast<int>(std::thread::hardware_concurrency());
+    return hardware_threads > 1 ? hardware_threads - 1 : 0;
+#else
+    return 0;
+#endif
+}
+
+void run_jobs(worker_pool& pool, const int job_count, const job_function job, void* context)
+{
+    if (job_count <= 0) return;
+
+#if USE_THREADS
+    if (pool.thread_count > 0 && job_count > 1)
+    {
+        {
+            //workers that woke late for the previous batch find it empty, let them leave first
+            std::unique_lock<std::mutex> guard(pool.lock);
+            pool.batch_done.wait(guard, [&] { return pool.active_workers == 0; });
+
+            pool.job = job;
+            pool.context = context;
+            pool.job_count = job_count;
+            pool.next_job = 0;
+            pool.jobs_done = 0;
+            pool.generation++;
+        }
+        pool.batch_ready.notify_all();
+
+        work_on_batch(pool, job, context, job_count);
+
+        //wait for jobs still running on the workers, and for the workers to leave the batch
+        std::unique_lock<std::mutex> guard(pool.lock);
+        pool.batch_done.wait(guard, [&] {
+            return pool.jobs_done.load() == job_count && pool.active_workers == 0;
+        });
+
+        return;
+    }
+#endif
+
+    for (auto i = 0; i < job_count; i++)
+    {
+        job(context, i);
+    }
+}
+
+template<typename function>
+void parallel_for(worker_pool& pool, const int job_count, const function& fn)
+{
+    run_jobs(pool, job_count, [](void* context, const int job_idx) {
+        (*static_cast<const function*>(context))(job_idx);
+    }, const_cast<function*>(&fn));
+}
@@ -0,0 +1,67 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+/*
+ * Threads are available on desktop targets, and in emscripten builds made with
+ * "-pthread". Other emscripten builds run every job on the calling thread, so code
+ * using the pool must not depend on jobs running concurrently.
+ */
+#if !defined(EMSCRIPTEN) || defined(__EMSCRIPTEN_PTHREADS__)
+#define USE_THREADS 1
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#else
+#define USE_THREADS 0
+#endif
+
+/*
+ * A fixed set of worker threads that run batches of jobs. A batch is a job function
+ * and a job count, the function is called once for every index in the batch. The
+ * calling thread works on the batch too, and run_jobs returns once every job is done.
+ *
+ * Jobs are claimed one at a time from a shared counter, so batches of uneven jobs
+ * (such as decoding images of different sizes) balance across the threads.
+ */
+typedef void (*job_function)(void* context, int job_idx);
+
+struct worker_pool
+{
+    int thread_count{};
+
+#if USE_THREADS
+    std::vector<std::thread> threads;
+
+    std::mutex lock;
+    std::condition_variable batch_ready;
+    std::condition_variable batch_done;
+
+    //current batch, generation changes whenever a new batch is started
+    job_function job{};
+    void* context{};
+    int job_count{};
+    unsigned generation{};
+    bool shutting_down{};
+    int active_workers{};
+
+    std::atomic<int> next_job{};
+    std::atomic<int> jobs_done{};
+#endif
+};
+
+//starts worker_count threads, 0 runs every job on the calling thread
+void init_worker_pool(worker_pool& pool, int worker_count);
+void shutdown_worker_pool(worker_pool& pool);
+
+//threads worth starting on this machine, leaving one for the caller
+int default_worker_count();
+
+void run_jobs(worker_pool& pool, int job_count, job_function job, void* context);
+
+//runs fn(job_idx) for every index below job_count
+template<typename function>
+void parallel_for(worker_pool& pool, int job_count, const function& fn);
+
+#endif